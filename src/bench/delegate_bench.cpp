@@ -0,0 +1,68 @@
+// Measures the cost of one call through each way of wiring a handler:
+// - direct call of the method (baseline);
+// - delegate bound to the method, and to a lambda;
+// - std::function wrapping a lambda;
+// - event with a raw pointer owner subscribed.
+
+#include "delegate.h"
+#include "event.h"
+
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace po = boost::program_options;
+
+struct sink
+{
+    void on_value(uint64_t v) {m_sum += v ^ (m_sum >> 7);}
+
+    uint64_t m_sum = 0;
+};
+
+template<typename F>
+double ns_per_call(uint64_t calls, F&& call)
+{
+    auto begin = steady_clock::now();
+    for(uint64_t i = 0; i < calls; ++i)
+        call(i);
+    return duration_cast<nanoseconds>(steady_clock::now() - begin).count() / static_cast<double>(calls);
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("calls", po::value<uint64_t>()->default_value(50'000'000), "Number of calls per measurement");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    uint64_t calls = vm.at("calls").as<uint64_t>();
+
+    sink s;
+    auto lambda = [&s](uint64_t v){s.on_value(v);};
+
+    auto dlg_method = scheduling::delegate<uint64_t>::bind<&sink::on_value>(&s);
+    auto dlg_lambda = scheduling::delegate<uint64_t>::bind(&lambda);
+    std::function<void(uint64_t)> func = lambda;
+
+    scheduling::event<uint64_t> evt;
+    evt.subscribe(&s, &sink::on_value);
+
+    std::cout << "direct call: " << ns_per_call(calls, [&s](uint64_t v){s.on_value(v);}) << " ns" << std::endl;
+    std::cout << "delegate (method): " << ns_per_call(calls, [&dlg_method](uint64_t v){dlg_method(v);}) << " ns" << std::endl;
+    std::cout << "delegate (lambda): " << ns_per_call(calls, [&dlg_lambda](uint64_t v){dlg_lambda(v);}) << " ns" << std::endl;
+    std::cout << "std::function: " << ns_per_call(calls, [&func](uint64_t v){func(v);}) << " ns" << std::endl;
+    std::cout << "event: " << ns_per_call(calls, [&evt](uint64_t v){evt.invoke(v);}) << " ns" << std::endl;
+
+    // Keeps the handler from being optimized out
+    std::cout << "[" << s.m_sum % 10 << "]" << std::endl;
+    return 0;
+}
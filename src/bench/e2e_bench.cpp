@@ -0,0 +1,629 @@
+// End-to-end loopback benchmark: for every combination of payload size, number of TCP servers,
+// number of UDP shards, number of TCP threads, TCP io_context model and I/O engine,
+// starts utf_echo_backend servers and the forwarder, drives it with utf_loadgen in closed loop and records:
+// - pps: replies per second seen by the load generator;
+// - cpu_us_per_packet: forwarder's CPU time (user + system) per datagram it received;
+// - allocs_per_packet: forwarder's calls to operator new (utf_heap_allocs) per datagram it received,
+//   the scrapes themselves add a few hundred, which is lost in the noise of a run;
+// - loss_ratio and latency percentiles, as reported by the load generator.
+// Results are written as JSON, and io_uring points are compared to asio points of the same parameters.
+// Points where the forwarder fell back to asio for some endpoints are flagged and left out of comparisons.
+// With --baseline, every point is compared to the baseline point of the same parameters
+// and the bench fails if any of them is worse than the tolerance allows.
+// A missing baseline isn't a pass: the bench exits with NO_BASELINE_EXIT_CODE.
+
+#include "json_parser.h"
+
+#include <boost/asio.hpp>
+#include <boost/json.hpp>
+#include <boost/program_options.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern char** environ;
+
+using namespace std::chrono;
+
+namespace asio = boost::asio;
+namespace json = boost::json;
+namespace po = boost::program_options;
+
+// Processes are given this long to start listening and to exit on SIGTERM
+static constexpr auto STARTUP_TIMEOUT = seconds(5);
+static constexpr auto SHUTDOWN_TIMEOUT = seconds(5);
+
+// Forwarder's connections to TCP servers are set up after it starts listening
+static constexpr auto SETTLE_TIME = milliseconds(500);
+
+// Relative tolerance is widened by this much for metrics close to zero
+static constexpr double ABSOLUTE_SLACK = 0.01;
+
+// Exit code when there's no baseline to compare to, CTest reports the run as skipped
+static constexpr int NO_BASELINE_EXIT_CODE = 77;
+
+struct bench_point
+{
+    uint32_t payload_size;
+    uint32_t backends;
+    uint32_t shards;
+    uint32_t tcp_threads;
+    std::string tcp_io;
+    std::string engine;
+
+    // Some endpoints were driven by asio instead of the engine asked for
+    bool is_fallback = false;
+
+    double pps = 0.0;
+    double loss_ratio = 0.0;
+    double cpu_us_per_packet = 0.0;
+    double allocs_per_packet = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double p99_9_us = 0.0;
+
+    std::string key() const
+    {
+        return "size=" + std::to_string(payload_size) +
+            ",backends=" + std::to_string(backends) +
+            ",shards=" + std::to_string(shards) +
+            ",tcp_threads=" + std::to_string(tcp_threads) +
+            ",tcp_io=" + tcp_io +
+            ",engine=" + engine;
+    }
+};
+
+// How a metric is compared to its baseline
+struct metric_check
+{
+    const char* name;
+    double bench_point::* value;
+    bool is_higher_better;
+    bool is_latency;
+};
+
+static constexpr metric_check CHECKS[] =
+{
+    {"pps", &bench_point::pps, true, false},
+    {"loss_ratio", &bench_point::loss_ratio, false, false},
+    {"cpu_us_per_packet", &bench_point::cpu_us_per_packet, false, false},
+    {"allocs_per_packet", &bench_point::allocs_per_packet, false, false},
+    {"p50_us", &bench_point::p50_us, false, true},
+    {"p99_us", &bench_point::p99_us, false, true},
+    {"p99_9_us", &bench_point::p99_9_us, false, true}
+};
+
+// Child process, terminated when the object is destroyed
+class child_process
+{
+public:
+    // Output goes to the pipe if asked for, and is discarded otherwise
+    child_process(const std::vector<std::string>& args, bool capture_output = false)
+    {
+        std::vector<char*> argv;
+        for(const auto& arg : args)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        int out_pipe[2] = {-1, -1};
+        if(capture_output)
+        {
+            if(::pipe(out_pipe) < 0)
+                throw std::runtime_error("Can't create a pipe");
+            posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(&actions, out_pipe[0]);
+        }
+        else
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+        int err = posix_spawn(&m_pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if(capture_output)
+        {
+            ::close(out_pipe[1]);
+            m_out_fd = out_pipe[0];
+        }
+        if(err != 0)
+        {
+            m_pid = -1;
+            throw std::runtime_error("Can't start " + args.front() + ": " + std::strerror(err));
+        }
+    }
+
+    ~child_process()
+    {
+        terminate();
+        if(m_out_fd >= 0)
+            ::close(m_out_fd);
+    }
+
+    child_process(const child_process&) = delete;
+    child_process& operator=(const child_process&) = delete;
+
+    pid_t pid() const {return m_pid;}
+
+    // Reads the output till the process closes it, then waits for the process to exit
+    std::string read_output()
+    {
+        std::string out;
+        char buf[4096];
+        ssize_t size;
+        while((size = ::read(m_out_fd, buf, sizeof(buf))) > 0)
+            out.append(buf, size);
+
+        int status = 0;
+        ::waitpid(m_pid, &status, 0);
+        m_pid = -1;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw std::runtime_error("Child process failed");
+        return out;
+    }
+
+    // SIGTERM first, SIGKILL if it doesn't exit in time
+    void terminate()
+    {
+        if(m_pid < 0)
+            return;
+
+        ::kill(m_pid, SIGTERM);
+        auto deadline = steady_clock::now() + SHUTDOWN_TIMEOUT;
+        while(::waitpid(m_pid, nullptr, WNOHANG) == 0)
+        {
+            if(steady_clock::now() > deadline)
+            {
+                ::kill(m_pid, SIGKILL);
+                ::waitpid(m_pid, nullptr, 0);
+                break;
+            }
+            std::this_thread::sleep_for(milliseconds(10));
+        }
+        m_pid = -1;
+    }
+
+private:
+    pid_t m_pid = -1;
+    int m_out_fd = -1;
+};
+
+// User and system CPU time of a process so far, in microseconds
+static double cpu_time_us(pid_t pid)
+{
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    std::getline(stat, line);
+
+    // Fields after the executable name, which may contain spaces; utime and stime are 14th and 15th
+    auto pos = line.rfind(')');
+    if(pos == std::string::npos)
+        throw std::runtime_error("Can't read CPU time of " + std::to_string(pid));
+
+    std::istringstream fields(line.substr(pos + 2));
+    std::string skip;
+    for(int i = 3; i < 14; ++i)
+        fields >> skip;
+    uint64_t utime = 0, stime = 0;
+    fields >> utime >> stime;
+
+    return static_cast<double>(utime + stime) * 1e6 / ::sysconf(_SC_CLK_TCK);
+}
+
+static bool can_connect(uint16_t port)
+{
+    asio::io_context ioc;
+    asio::ip::tcp::socket sock(ioc);
+    boost::system::error_code ec;
+    sock.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port), ec);
+    return !ec;
+}
+
+static void wait_for_port(uint16_t port)
+{
+    auto deadline = steady_clock::now() + STARTUP_TIMEOUT;
+    while(!can_connect(port))
+    {
+        if(steady_clock::now() > deadline)
+            throw std::runtime_error("Nothing listens on port " + std::to_string(port));
+        std::this_thread::sleep_for(milliseconds(20));
+    }
+}
+
+// Sum of every series of the metric, scraped from the forwarder's metrics endpoint.
+// A name with labels (name{label="value"}) picks the single series.
+static double scrape_metric(uint16_t port, const std::string& name)
+{
+    asio::io_context ioc;
+    asio::ip::tcp::socket sock(ioc);
+    sock.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+    asio::write(sock, asio::buffer(std::string("GET /metrics HTTP/1.0\r\n\r\n")));
+
+    std::string resp;
+    boost::system::error_code ec;
+    asio::read(sock, asio::dynamic_buffer(resp), ec);
+
+    double sum = 0.0;
+    std::istringstream lines(resp);
+    std::string line;
+    while(std::getline(lines, line))
+    {
+        if(line.compare(0, name.size(), name) != 0 || line.size() <= name.size())
+            continue;
+        if(line[name.size()] != ' ' && line[name.size()] != '{')
+            continue;
+        sum += std::stod(line.substr(line.rfind(' ') + 1));
+    }
+    return sum;
+}
+
+static std::string make_config(uint16_t udp_port, uint16_t metrics_port, uint16_t first_backend_port, const bench_point& pt)
+{
+    json::array clients;
+    for(uint32_t i = 0; i < pt.backends; ++i)
+        clients.push_back(json::object{{"ipv4", "127.0.0.1"}, {"port", first_backend_port + i}, {"connections", 1}});
+
+    json::object cfg
+    {
+        {"udp_ports", json::array{udp_port}},
+        {"udp_shards", pt.shards},
+        {"runtime", json::object{{"tcp_threads", pt.tcp_threads}, {"tcp_io", pt.tcp_io}}},
+        {"tcp_clients", std::move(clients)},
+        {"io_engine", pt.engine},
+        {"metrics_port", metrics_port},
+        {"logging_level", 4}
+    };
+    return json::serialize(cfg);
+}
+
+struct bench_options
+{
+    std::string forwarder;
+    std::string loadgen;
+    std::string echo_backend;
+    uint16_t base_port;
+    uint32_t concurrency;
+    double duration;
+    double warmup;
+};
+
+static void run_point(const bench_options& opts, bench_point& pt)
+{
+    uint16_t udp_port = opts.base_port;
+    uint16_t metrics_port = opts.base_port + 1;
+    uint16_t first_backend_port = opts.base_port + 2;
+
+    std::vector<std::unique_ptr<child_process>> backends;
+    for(uint32_t i = 0; i < pt.backends; ++i)
+    {
+        backends.push_back(std::make_unique<child_process>(std::vector<std::string>{
+            opts.echo_backend, "--port", std::to_string(first_backend_port + i), "--threads", "1"
+        }));
+        wait_for_port(first_backend_port + i);
+    }
+
+    auto cfg_path = std::filesystem::temp_directory_path() / ("utf_e2e_" + std::to_string(::getpid()) + ".json");
+    std::ofstream(cfg_path) << make_config(udp_port, metrics_port, first_backend_port, pt);
+
+    child_process fwdr({opts.forwarder, "--config", cfg_path.string()});
+    wait_for_port(metrics_port);
+    std::this_thread::sleep_for(SETTLE_TIME);
+
+    // Endpoints come up with the forwarder, TCP connections included once it has settled
+    if(pt.engine != "asio")
+        pt.is_fallback = scrape_metric(metrics_port, "utf_io_engine_endpoints{engine=\"asio\"}") > 0;
+
+    double cpu_before = cpu_time_us(fwdr.pid());
+    double packets_before = scrape_metric(metrics_port, "utf_udp_datagrams_received_total");
+    double allocs_before = scrape_metric(metrics_port, "utf_heap_allocs");
+
+    child_process gen({
+        opts.loadgen, "--port", std::to_string(udp_port), "--mode", "closed",
+        "--concurrency", std::to_string(opts.concurrency),
+        "--duration", std::to_string(opts.duration), "--warmup", std::to_string(opts.warmup),
+        "--sizes", std::to_string(pt.payload_size)
+    }, true);
+    auto report = json::parse(gen.read_output()).as_object();
+
+    double cpu_us = cpu_time_us(fwdr.pid()) - cpu_before;
+    double packets = scrape_metric(metrics_port, "utf_udp_datagrams_received_total") - packets_before;
+    double allocs = scrape_metric(metrics_port, "utf_heap_allocs") - allocs_before;
+
+    fwdr.terminate();
+    std::filesystem::remove(cfg_path);
+
+    const auto& latency = report.at("latency_us").as_object();
+    pt.pps = report.at("throughput").to_number<double>();
+    pt.loss_ratio = report.at("loss_ratio").to_number<double>();
+    pt.cpu_us_per_packet = packets > 0 ? cpu_us / packets : 0.0;
+    pt.allocs_per_packet = packets > 0 ? allocs / packets : 0.0;
+    pt.p50_us = latency.at("p50").to_number<double>();
+    pt.p99_us = latency.at("p99").to_number<double>();
+    pt.p99_9_us = latency.at("p99_9").to_number<double>();
+}
+
+static json::object to_json(const bench_point& pt)
+{
+    json::object obj
+    {
+        {"payload_size", pt.payload_size},
+        {"backends", pt.backends},
+        {"shards", pt.shards},
+        {"tcp_threads", pt.tcp_threads},
+        {"tcp_io", pt.tcp_io},
+        {"engine", pt.engine}
+    };
+    if(pt.is_fallback)
+        obj["fallback"] = true;
+    for(const auto& check : CHECKS)
+        obj[check.name] = pt.*check.value;
+    return obj;
+}
+
+// One point per line, so baselines diff well
+static void write_results(const std::string& path, const std::vector<bench_point>& points)
+{
+    std::ofstream out(path);
+    if(!out)
+        throw std::runtime_error("Can't write " + path);
+
+    out << "{\"points\": [\n";
+    for(size_t i = 0; i < points.size(); ++i)
+        out << "  " << json::serialize(to_json(points[i])) << (i + 1 < points.size() ? ",\n" : "\n");
+    out << "]}\n";
+}
+
+static std::vector<uint32_t> parse_list(const std::string& str)
+{
+    std::vector<uint32_t> res;
+    std::istringstream items(str);
+    std::string item;
+    while(std::getline(items, item, ','))
+        res.push_back(std::stoul(item));
+    if(res.empty())
+        throw std::invalid_argument("Empty list: " + str);
+    return res;
+}
+
+// Names separated by commas, every one of them has to be among the known ones
+static std::vector<std::string> parse_names(const std::string& str, const std::vector<std::string>& known)
+{
+    std::vector<std::string> res;
+    std::istringstream items(str);
+    std::string item;
+    while(std::getline(items, item, ','))
+    {
+        if(std::find(known.begin(), known.end(), item) == known.end())
+            throw std::invalid_argument("Unknown value: " + item);
+        res.push_back(item);
+    }
+    if(res.empty())
+        throw std::invalid_argument("Empty list: " + str);
+    return res;
+}
+
+// Prints how every io_uring point does relative to the asio point of the same parameters
+static void compare_engines(const std::vector<bench_point>& points)
+{
+    for(const auto& pt : points)
+    {
+        if(pt.engine != "io_uring")
+            continue;
+        if(pt.is_fallback)
+        {
+            std::cout << pt.key() << ": fell back to asio, not compared\n";
+            continue;
+        }
+
+        auto base = std::find_if(points.begin(), points.end(),
+            [&pt](const bench_point& other)
+            {
+                return other.engine == "asio" && other.payload_size == pt.payload_size &&
+                    other.backends == pt.backends && other.shards == pt.shards &&
+                    other.tcp_threads == pt.tcp_threads && other.tcp_io == pt.tcp_io;
+            }
+        );
+        if(base == points.end())
+            continue;
+
+        auto ratio = [](double now, double was){return was > 0 ? now / was : 0.0;};
+        std::cout << pt.key() << " vs asio: pps x" << ratio(pt.pps, base->pps) <<
+            ", cpu_us_per_packet x" << ratio(pt.cpu_us_per_packet, base->cpu_us_per_packet) <<
+            ", p50_us x" << ratio(pt.p50_us, base->p50_us) <<
+            ", p99_us x" << ratio(pt.p99_us, base->p99_us) << "\n";
+    }
+}
+
+// Returns the number of regressions
+static size_t compare(const std::vector<bench_point>& points, const std::string& baseline_path, double tolerance, double latency_tolerance)
+{
+    auto baseline_val = utf::aux::parse_json(baseline_path);
+    if(!baseline_val)
+        throw std::runtime_error("Can't parse the baseline");
+    const auto& baseline = baseline_val->as_object().at("points").as_array();
+
+    size_t regressions = 0;
+    for(const auto& pt : points)
+    {
+        if(pt.is_fallback)
+        {
+            std::cout << pt.key() << ": fell back to asio, not compared to the baseline\n";
+            continue;
+        }
+
+        auto same = [&pt](const json::value& v)
+        {
+            // Fallbacks ran another engine than the one asked for, they aren't a reference
+            const auto& obj = v.as_object();
+            return !obj.contains("fallback") &&
+                obj.at("payload_size").to_number<uint32_t>() == pt.payload_size &&
+                obj.at("backends").to_number<uint32_t>() == pt.backends &&
+                obj.at("shards").to_number<uint32_t>() == pt.shards &&
+                obj.at("tcp_threads").to_number<uint32_t>() == pt.tcp_threads &&
+                obj.at("tcp_io").as_string() == pt.tcp_io &&
+                obj.at("engine").as_string() == pt.engine;
+        };
+        auto base = std::find_if(baseline.begin(), baseline.end(), same);
+        if(base == baseline.end())
+        {
+            std::cout << pt.key() << ": not in the baseline\n";
+            continue;
+        }
+
+        for(const auto& check : CHECKS)
+        {
+            double was = base->as_object().at(check.name).to_number<double>();
+            double now = pt.*check.value;
+            double tol = check.is_latency ? latency_tolerance : tolerance;
+
+            bool is_worse = check.is_higher_better ?
+                now < was * (1.0 - tol) :
+                now > was * (1.0 + tol) + ABSOLUTE_SLACK;
+            if(is_worse)
+            {
+                ++regressions;
+                std::cout << pt.key() << ": " << check.name << " regressed from " << was << " to " << now << "\n";
+            }
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("forwarder", po::value<std::string>(), "Path to udp_tcp_forwarder")
+        ("loadgen", po::value<std::string>(), "Path to utf_loadgen")
+        ("echo-backend", po::value<std::string>(), "Path to utf_echo_backend")
+        ("sizes", po::value<std::string>()->default_value("64,512,1400"), "Payload sizes, separated by commas")
+        ("backends", po::value<std::string>()->default_value("1,4"), "Numbers of TCP servers, separated by commas")
+        ("shards", po::value<std::string>()->default_value("1,2"), "Numbers of UDP shards, separated by commas")
+        ("tcp-threads", po::value<std::string>()->default_value("1,2"), "Numbers of TCP threads, separated by commas")
+        ("tcp-io", po::value<std::string>()->default_value("shared"), "TCP io_context models (shared, per_thread), separated by commas")
+        ("engines", po::value<std::string>()->default_value("asio,io_uring"), "I/O engines (asio, io_uring), separated by commas")
+        ("concurrency", po::value<uint32_t>()->default_value(256), "Requests in flight")
+        ("duration", po::value<double>()->default_value(5), "Seconds of load per point")
+        ("warmup", po::value<double>()->default_value(1), "Leading seconds that aren't measured")
+        ("base-port", po::value<uint16_t>()->default_value(30000), "UDP port, followed by metrics and TCP servers ports")
+        ("output", po::value<std::string>()->default_value("e2e_results.json"), "Where to write results")
+        ("baseline", po::value<std::string>(), "Results to compare to")
+        ("write-baseline", po::bool_switch(), "Write results to the baseline instead of comparing")
+        ("tolerance", po::value<double>()->default_value(0.1), "Allowed relative regression of throughput, CPU and allocations")
+        ("latency-tolerance", po::value<double>()->default_value(0.5), "Allowed relative regression of latency percentiles");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if(vm.count("help") || !vm.count("forwarder") || !vm.count("loadgen") || !vm.count("echo-backend"))
+    {
+        std::cout << "Usage: utf_e2e_bench [options] --forwarder <path> --loadgen <path> --echo-backend <path>\n" << desc;
+        return vm.count("help") ? 0 : -1;
+    }
+
+    // A child that dies mid-write shouldn't take the bench down
+    ::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<bench_point> points;
+    try
+    {
+        bench_options opts
+        {
+            .forwarder = vm.at("forwarder").as<std::string>(),
+            .loadgen = vm.at("loadgen").as<std::string>(),
+            .echo_backend = vm.at("echo-backend").as<std::string>(),
+            .base_port = vm.at("base-port").as<uint16_t>(),
+            .concurrency = vm.at("concurrency").as<uint32_t>(),
+            .duration = vm.at("duration").as<double>(),
+            .warmup = vm.at("warmup").as<double>()
+        };
+
+        auto sizes = parse_list(vm.at("sizes").as<std::string>());
+        auto backends_counts = parse_list(vm.at("backends").as<std::string>());
+        auto shards_counts = parse_list(vm.at("shards").as<std::string>());
+        auto tcp_threads_counts = parse_list(vm.at("tcp-threads").as<std::string>());
+        auto tcp_io_models = parse_names(vm.at("tcp-io").as<std::string>(), {"shared", "per_thread"});
+        auto engines = parse_names(vm.at("engines").as<std::string>(), {"asio", "io_uring"});
+
+        // Every combination of the swept parameters
+        for(uint32_t size : sizes)
+        for(uint32_t backends : backends_counts)
+        for(uint32_t shards : shards_counts)
+        for(uint32_t tcp_threads : tcp_threads_counts)
+        for(const auto& tcp_io : tcp_io_models)
+        for(const auto& engine : engines)
+        {
+            bench_point pt{size, backends, shards, tcp_threads, tcp_io, engine};
+            run_point(opts, pt);
+            std::cout << pt.key() << ": " << json::serialize(to_json(pt)) << std::endl;
+            points.push_back(pt);
+        }
+
+        write_results(vm.at("output").as<std::string>(), points);
+        compare_engines(points);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if(!vm.count("baseline"))
+        return 0;
+
+    const auto& baseline_path = vm.at("baseline").as<std::string>();
+    if(vm.at("write-baseline").as<bool>())
+    {
+        write_results(baseline_path, points);
+        std::cout << "Baseline written to " << baseline_path << "\n";
+        return 0;
+    }
+    if(!std::filesystem::exists(baseline_path))
+    {
+        std::cerr << "No baseline at " << baseline_path << ", nothing was compared. Record one with --write-baseline\n";
+        return NO_BASELINE_EXIT_CODE;
+    }
+
+    try
+    {
+        size_t regressions = compare(points, baseline_path,
+            vm.at("tolerance").as<double>(), vm.at("latency-tolerance").as<double>());
+        if(regressions > 0)
+        {
+            std::cout << regressions << " regressions\n";
+            return 1;
+        }
+        std::cout << "No regressions\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Can't compare to " << baseline_path << ": " << e.what() << "\n";
+        return -1;
+    }
+    return 0;
+}
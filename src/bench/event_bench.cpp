@@ -0,0 +1,185 @@
+// Measures the cost of scheduling::event::invoke against the previous implementation
+// (unordered_maps of callbacks behind a shared mutex, kept below as legacy_event):
+// - with a raw pointer owner, a shared pointer owner and a functor subscribed;
+// - invoked from one thread, then from several threads at once.
+
+#include "event.h"
+
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace po = boost::program_options;
+
+template<class ... Args>
+class legacy_event
+{
+    template <class Owner>
+    using handler_member = void (Owner::*)(Args ...);
+    using handler_func = std::function<void(Args ...)>;
+
+public:
+    void invoke(Args... args)
+    {
+        std::vector<size_t> junktown;
+
+        {
+        std::shared_lock l(m_cb_access_mx);
+        for(auto& cb : m_cb)
+        {
+            auto erase_request = [&cb, &junktown] () {junktown.push_back(cb.first);};
+
+            cb.second(erase_request, args...);
+        }
+        }
+
+        {
+        std::shared_lock l(m_cb_access_mx);
+        for(auto& cb : m_hashless_cb)
+        {
+            cb.second(args...);
+        }
+        }
+
+        {
+        std::shared_lock l(m_cb_access_mx);
+        for(const size_t& hash : junktown)
+        {
+            m_cb.erase(hash);
+        }
+        }
+    }
+
+    template<class Owner>
+    void subscribe(std::shared_ptr<Owner> optr, handler_member<Owner> hdlr)
+    {
+        size_t hash = std::hash<Owner*>{}(optr.get()) ^ std::hash<unsigned long>{}(*reinterpret_cast<unsigned long*>(&hdlr));
+        std::weak_ptr<Owner> weak = optr;
+
+        auto wrapper =
+        [weak, hdlr](std::function<void()> del_req, Args&&... args)
+        {
+            auto shared = weak.lock();
+            if(!shared)
+            {
+                del_req();
+                return;
+            }
+            (shared.get()->*hdlr)(args...);
+        };
+
+        std::unique_lock l(m_cb_access_mx);
+        m_cb.emplace(hash, wrapper);
+    }
+
+    template<class Owner>
+    void subscribe(Owner* optr, handler_member<Owner> hdlr)
+    {
+        size_t hash = std::hash<Owner*>{}(optr) ^ std::hash<unsigned long>{}(*reinterpret_cast<unsigned long*>(&hdlr));
+
+        auto wrapper =
+        [optr, hdlr]([[maybe_unused]] std::function<void()> del_req, Args... args)
+        {
+            (optr->*hdlr)(args...);
+        };
+
+        std::unique_lock l(m_cb_access_mx);
+        m_cb.emplace(hash, wrapper);
+    }
+
+    void subscribe(size_t id, handler_func hdlr)
+    {
+        std::unique_lock l(m_cb_access_mx);
+        m_hashless_cb.emplace(id, hdlr);
+    }
+
+private:
+    std::unordered_map<size_t, std::function<void(std::function<void()>, Args...)>> m_cb;
+    std::unordered_map<size_t, handler_func> m_hashless_cb;
+    std::shared_mutex m_cb_access_mx;
+};
+
+// Accumulates per thread, so handlers don't contend with each other
+thread_local uint64_t handled_sum = 0;
+
+struct sink
+{
+    void on_value(const uint64_t& v) {handled_sum += v;}
+};
+
+// Raw pointer, shared pointer and functor subscribers, as in the forwarder
+template<typename Event>
+void populate(Event& evt, sink& raw_sink, std::shared_ptr<sink> shared_sink)
+{
+    evt.subscribe(&raw_sink, &sink::on_value);
+    evt.subscribe(shared_sink, &sink::on_value);
+    evt.subscribe(0, [&raw_sink](const uint64_t& v){raw_sink.on_value(v);});
+}
+
+// Keeps the handlers from being optimized out
+std::atomic_uint64_t checksum = 0;
+
+template<typename Event>
+double ns_per_invoke(Event& evt, uint64_t invokes, uint32_t threads)
+{
+    std::vector<std::thread> workers;
+    auto begin = steady_clock::now();
+    for(uint32_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&evt, invokes]()
+        {
+            for(uint64_t i = 0; i < invokes; ++i)
+                evt.invoke(i);
+            checksum.fetch_add(handled_sum);
+        });
+    }
+    for(auto& w : workers)
+        w.join();
+
+    // Per invocation, as seen by each thread
+    return duration_cast<nanoseconds>(steady_clock::now() - begin).count() / static_cast<double>(invokes);
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("invokes", po::value<uint64_t>()->default_value(5'000'000), "Number of invocations per thread")
+        ("threads", po::value<uint32_t>()->default_value(4), "Number of invoking threads in the concurrent run");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    uint64_t invokes = vm.at("invokes").as<uint64_t>();
+    uint32_t threads = vm.at("threads").as<uint32_t>();
+
+    sink raw_sink;
+    auto shared_sink = std::make_shared<sink>();
+
+    legacy_event<const uint64_t&> legacy;
+    scheduling::event<const uint64_t&> current;
+    populate(legacy, raw_sink, shared_sink);
+    populate(current, raw_sink, shared_sink);
+
+    for(uint32_t t : {1u, threads})
+    {
+        double legacy_ns = ns_per_invoke(legacy, invokes, t);
+        double current_ns = ns_per_invoke(current, invokes, t);
+
+        std::cout << t << " thread(s): legacy " << legacy_ns << " ns/invoke, current " << current_ns << " ns/invoke" << std::endl;
+    }
+
+    std::cout << "[" << checksum.load() % 10 << "]" << std::endl;
+    return 0;
+}
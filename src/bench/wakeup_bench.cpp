@@ -0,0 +1,200 @@
+// Measures what the forwarder's wakeup mode costs:
+// - CPU consumed by the process while no traffic is flowing;
+// - round trip latency of sparse requests (forwarder has to wake up for each one),
+//   through an in-process TCP echo server.
+
+#include "endpoints/include/endpoint_impl.h"
+#include "rr_forwarder.h"
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace po = boost::program_options;
+
+class echo_session : public std::enable_shared_from_this<echo_session>
+{
+public:
+    echo_session(boost::asio::ip::tcp::socket&& sock) : m_sock(std::move(sock)), m_buf(4096) {}
+
+    void start() {read();}
+
+private:
+    void read()
+    {
+        auto self = shared_from_this();
+        m_sock.async_read_some(boost::asio::buffer(m_buf),
+            [self](const boost::system::error_code& ec, size_t n)
+            {
+                if(ec)
+                    return;
+                boost::asio::async_write(self->m_sock, boost::asio::buffer(self->m_buf.data(), n),
+                    [self](const boost::system::error_code& ec, size_t)
+                    {
+                        if(!ec)
+                            self->read();
+                    }
+                );
+            }
+        );
+    }
+
+    boost::asio::ip::tcp::socket m_sock;
+    std::vector<char> m_buf;
+};
+
+void accept_loop(boost::asio::ip::tcp::acceptor& acc)
+{
+    acc.async_accept([&acc](const boost::system::error_code& ec, boost::asio::ip::tcp::socket sock)
+    {
+        if(ec)
+            return;
+        std::make_shared<echo_session>(std::move(sock))->start();
+        accept_loop(acc);
+    });
+}
+
+double cpu_time_s()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+uint64_t now_ns()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void run(
+    const char* name,
+    scheduling::wakeup_mode mode,
+    uint32_t spin_us,
+    uint16_t echo_port,
+    uint32_t idle_ms,
+    uint32_t requests,
+    uint32_t interval_us
+)
+{
+    boost::asio::io_context ioc_tcp;
+    auto work = boost::asio::make_work_guard(ioc_tcp);
+    std::thread tcp_thread([&ioc_tcp](){ioc_tcp.run();});
+
+    std::vector<std::shared_ptr<endpoints::tcp_client_pool>> clients;
+    clients.push_back(std::make_shared<endpoints::tcp_client_pool>(
+        ioc_tcp,
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), echo_port),
+        1, 1000, 5000
+    ));
+    auto client = clients.front();
+    while(!client->is_connected())
+        std::this_thread::sleep_for(milliseconds(1));
+
+    scheduling::forwarder_options opts{.wakeup = mode, .spin_us = spin_us};
+    auto fwdr = std::make_shared<scheduling::rr_forwarder>(std::move(clients), opts);
+
+    std::vector<uint64_t> latencies_ns;
+    latencies_ns.reserve(requests);
+    std::atomic_uint32_t received = 0;
+    fwdr->send_back_evt.subscribe(0,
+        [&](uint32_t, boost::asio::ip::address_v4, uint16_t, const aux::byte_buffer& payload)
+        {
+            // Response payload is [status][echoed request payload]
+            uint64_t sent_ns;
+            std::memcpy(&sent_ns, payload.data() + sizeof(uint32_t), sizeof(sent_ns));
+            latencies_ns.push_back(now_ns() - sent_ns);
+            received.fetch_add(1);
+        }
+    );
+
+    // Idle CPU
+    double cpu_begin = cpu_time_s();
+    std::this_thread::sleep_for(milliseconds(idle_ms));
+    double idle_cpu = (cpu_time_s() - cpu_begin) * 1000.0 / idle_ms;
+
+    // Sparse requests, every one of them has to wake the forwarder up
+    for(uint32_t i = 0; i < requests; ++i)
+    {
+        uint64_t sent_ns = now_ns();
+        const char* sent_bytes = reinterpret_cast<const char*>(&sent_ns);
+        fwdr->schedule(scheduling::client_request(
+            0, 0, boost::asio::ip::address_v4::loopback(), 1,
+            sent_bytes, sent_bytes + sizeof(sent_ns)
+        ));
+        std::this_thread::sleep_for(microseconds(interval_us));
+    }
+
+    auto deadline = steady_clock::now() + seconds(5);
+    while(received.load() < requests && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(milliseconds(1));
+
+    fwdr.reset();
+    client->stop();
+    work.reset();
+    ioc_tcp.stop();
+    tcp_thread.join();
+
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    auto pct = [&latencies_ns](double p) -> double
+    {
+        if(latencies_ns.empty())
+            return 0;
+        return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))] / 1000.0;
+    };
+
+    std::cout << name <<
+        ": idle CPU " << idle_cpu * 100.0 << "%" <<
+        ", received " << latencies_ns.size() << "/" << requests <<
+        ", RTT p50 " << pct(0.5) << " us" <<
+        ", p99 " << pct(0.99) << " us" <<
+        ", p99.9 " << pct(0.999) << " us" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("idle-ms", po::value<uint32_t>()->default_value(2000), "Duration of idle CPU measurement")
+        ("requests", po::value<uint32_t>()->default_value(10000), "Number of requests per mode")
+        ("interval-us", po::value<uint32_t>()->default_value(200), "Pause between requests")
+        ("spin-us", po::value<uint32_t>()->default_value(50), "Spin duration in adaptive mode");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    spdlog::set_level(spdlog::level::off);
+
+    boost::asio::io_context ioc_echo;
+    boost::asio::ip::tcp::acceptor acc(ioc_echo,
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    accept_loop(acc);
+    std::thread echo_thread([&ioc_echo](){ioc_echo.run();});
+
+    uint16_t echo_port = acc.local_endpoint().port();
+    uint32_t idle_ms = vm.at("idle-ms").as<uint32_t>();
+    uint32_t requests = vm.at("requests").as<uint32_t>();
+    uint32_t interval_us = vm.at("interval-us").as<uint32_t>();
+    uint32_t spin_us = vm.at("spin-us").as<uint32_t>();
+
+    run("park", scheduling::wakeup_mode::park, 0, echo_port, idle_ms, requests, interval_us);
+    run("adaptive", scheduling::wakeup_mode::adaptive, spin_us, echo_port, idle_ms, requests, interval_us);
+
+    ioc_echo.stop();
+    echo_thread.join();
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Measures the cost of a weighted round robin pick as the number of backends grows:
+// - table: precomputed smooth WRR sequence, as used by wrr_forwarder;
+// - scan: classic smooth WRR, every pick updates and scans all the backends.
+// Both produce the same sequence, the bench checks that as well.
+
+#include "wrr_schedule.h"
+
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace po = boost::program_options;
+
+class scan_wrr
+{
+public:
+    explicit scan_wrr(const std::vector<uint32_t>& weights) :
+        m_weights(weights.begin(), weights.end()), m_current(weights.size(), 0)
+    {
+        for(int64_t w : m_weights)
+            m_total += w;
+    }
+
+    uint32_t next()
+    {
+        size_t best = 0;
+        for(size_t i = 0; i < m_weights.size(); ++i)
+        {
+            m_current[i] += m_weights[i];
+            if(m_current[i] > m_current[best])
+                best = i;
+        }
+        m_current[best] -= m_total;
+        return best;
+    }
+
+private:
+    std::vector<int64_t> m_weights;
+    std::vector<int64_t> m_current;
+    int64_t m_total = 0;
+};
+
+template<typename Scheduler>
+double ns_per_pick(Scheduler& sched, uint64_t picks, uint64_t& checksum)
+{
+    auto begin = steady_clock::now();
+    for(uint64_t i = 0; i < picks; ++i)
+        checksum += sched.next();
+    return duration_cast<nanoseconds>(steady_clock::now() - begin).count() / static_cast<double>(picks);
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("picks", po::value<uint64_t>()->default_value(10'000'000), "Number of picks per measurement")
+        ("max-weight", po::value<uint32_t>()->default_value(10), "Weights are drawn from [1, max-weight]");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    uint64_t picks = vm.at("picks").as<uint64_t>();
+    uint32_t max_weight = vm.at("max-weight").as<uint32_t>();
+
+    std::mt19937 rand_eng(42);
+    std::uniform_int_distribution<uint32_t> weight_distr(1, std::max<uint32_t>(max_weight, 1));
+
+    for(size_t backends : {2, 8, 32, 128, 512})
+    {
+        std::vector<uint32_t> weights(backends);
+        for(auto& w : weights)
+            w = weight_distr(rand_eng);
+
+        scheduling::wrr_schedule table(weights);
+        scan_wrr scan(weights);
+
+        // Same sequence over a few laps
+        bool is_same = true;
+        for(size_t i = 0; i < 3 * table.size(); ++i)
+            is_same = is_same && table.next() == scan.next();
+
+        uint64_t checksum = 0;
+        double table_ns = ns_per_pick(table, picks, checksum);
+        double scan_ns = ns_per_pick(scan, picks / backends + 1, checksum);
+
+        std::cout << backends << " backends" <<
+            ": table " << table_ns << " ns/pick (" << table.size() << " entries)" <<
+            ", scan " << scan_ns << " ns/pick" <<
+            (is_same ? "" : ", SEQUENCES DIFFER") <<
+            " [" << checksum % 10 << "]" << std::endl;
+    }
+    return 0;
+}
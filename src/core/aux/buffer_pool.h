@@ -0,0 +1,244 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+
+// Counters of the pool itself: a refill from the system allocator shows here, but an allocation
+// anywhere else on the packet path doesn't, aux::heap_allocs() counts those process-wide
+struct buffer_pool_stats
+{
+    // Blocks the pool took from / returned to the system allocator
+    uint64_t system_allocs;
+    uint64_t system_frees;
+
+    // Batches of blocks moved between thread caches and the shared depot
+    uint64_t depot_refills;
+    uint64_t depot_spills;
+};
+
+// Size-classed block pool with per-thread caches.
+// Blocks freed on one thread and allocated on another (e.g. payloads received by a UDP server
+// and released by the forwarder) travel through a shared depot in batches, so the depot lock
+// is taken once per BATCH_SIZE blocks. In steady state no block comes from the system allocator.
+class buffer_pool
+{
+public:
+    static void* allocate(size_t size)
+    {
+        size_t cls = size_class(size);
+        if(cls == CLASSES_COUNT)
+        {
+            s_system_allocs.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        auto& cache = t_cache.lists[cls];
+        if(!cache.head)
+            refill(cls);
+
+        if(!cache.head)
+        {
+            s_system_allocs.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(class_size(cls));
+        }
+
+        block* b = cache.head;
+        cache.head = b->next;
+        --cache.count;
+        return b;
+    }
+
+    static void deallocate(void* ptr, size_t size) noexcept
+    {
+        size_t cls = size_class(size);
+        if(cls == CLASSES_COUNT)
+        {
+            s_system_frees.fetch_add(1, std::memory_order_relaxed);
+            ::operator delete(ptr);
+            return;
+        }
+
+        auto& cache = t_cache.lists[cls];
+        block* b = static_cast<block*>(ptr);
+        b->next = cache.head;
+        cache.head = b;
+
+        if(++cache.count >= 2 * BATCH_SIZE)
+            spill(cls);
+    }
+
+    static buffer_pool_stats stats()
+    {
+        return buffer_pool_stats
+        {
+            .system_allocs = s_system_allocs.load(std::memory_order_relaxed),
+            .system_frees = s_system_frees.load(std::memory_order_relaxed),
+            .depot_refills = s_depot_refills.load(std::memory_order_relaxed),
+            .depot_spills = s_depot_spills.load(std::memory_order_relaxed)
+        };
+    }
+
+private:
+    // 64 bytes to 64 KiB, powers of two
+    static constexpr size_t MIN_CLASS_SHIFT = 6;
+    static constexpr size_t CLASSES_COUNT = 11;
+    static constexpr size_t BATCH_SIZE = 64;
+
+    struct block
+    {
+        block* next;
+    };
+
+    struct free_list
+    {
+        block* head = nullptr;
+        size_t count = 0;
+    };
+
+    // Blocks cached by a thread, handed over to the depot when the thread exits
+    struct thread_cache
+    {
+        std::array<free_list, CLASSES_COUNT> lists;
+
+        ~thread_cache()
+        {
+            for(size_t cls = 0; cls < CLASSES_COUNT; ++cls)
+            {
+                if(lists[cls].head)
+                {
+                    std::lock_guard l(s_depot_mx);
+                    s_depot.lists[cls].push_back(lists[cls]);
+                    lists[cls] = free_list{};
+                }
+            }
+        }
+    };
+
+    // Blocks shared by all threads, released to the system on exit
+    struct depot
+    {
+        std::array<std::vector<free_list>, CLASSES_COUNT> lists;
+
+        ~depot()
+        {
+            for(auto& batches : lists)
+            {
+                for(auto& batch : batches)
+                {
+                    while(batch.head)
+                    {
+                        block* next = batch.head->next;
+                        ::operator delete(batch.head);
+                        batch.head = next;
+                    }
+                }
+            }
+        }
+    };
+
+    static size_t class_size(size_t cls) {return size_t(1) << (cls + MIN_CLASS_SHIFT);}
+
+    // Index of the smallest class that fits, CLASSES_COUNT if none does
+    static size_t size_class(size_t size)
+    {
+        if(size <= class_size(0))
+            return 0;
+
+        size_t cls = std::bit_width(size - 1) - MIN_CLASS_SHIFT;
+        return cls < CLASSES_COUNT ? cls : CLASSES_COUNT;
+    }
+
+    static void refill(size_t cls)
+    {
+        std::lock_guard l(s_depot_mx);
+        auto& depot = s_depot.lists[cls];
+        if(depot.empty())
+            return;
+
+        t_cache.lists[cls] = depot.back();
+        depot.pop_back();
+        s_depot_refills.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void spill(size_t cls)
+    {
+        // Keep one batch, move the other one to the depot
+        auto& cache = t_cache.lists[cls];
+        free_list batch{cache.head, 0};
+        block* last = cache.head;
+        for(size_t i = 1; i < BATCH_SIZE; ++i)
+            last = last->next;
+
+        cache.head = last->next;
+        cache.count -= BATCH_SIZE;
+        last->next = nullptr;
+        batch.count = BATCH_SIZE;
+
+        std::lock_guard l(s_depot_mx);
+        s_depot.lists[cls].push_back(batch);
+        s_depot_spills.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static thread_local thread_cache t_cache;
+
+    static std::mutex s_depot_mx;
+    static depot s_depot;
+
+    static std::atomic_uint64_t s_system_allocs;
+    static std::atomic_uint64_t s_system_frees;
+    static std::atomic_uint64_t s_depot_refills;
+    static std::atomic_uint64_t s_depot_spills;
+};
+
+inline thread_local buffer_pool::thread_cache buffer_pool::t_cache;
+
+inline std::mutex buffer_pool::s_depot_mx;
+inline buffer_pool::depot buffer_pool::s_depot;
+
+inline std::atomic_uint64_t buffer_pool::s_system_allocs = 0;
+inline std::atomic_uint64_t buffer_pool::s_system_frees = 0;
+inline std::atomic_uint64_t buffer_pool::s_depot_refills = 0;
+inline std::atomic_uint64_t buffer_pool::s_depot_spills = 0;
+
+template<typename T>
+struct pool_allocator
+{
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "Over-aligned types aren't supported");
+
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+
+    template<typename U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(buffer_pool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        buffer_pool::deallocate(ptr, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const pool_allocator<U>&) const noexcept {return true;}
+};
+
+// Payload storage for requests and responses
+using byte_buffer = std::vector<char, pool_allocator<char>>;
+
+}
+}
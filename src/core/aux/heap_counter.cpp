@@ -0,0 +1,58 @@
+#include "heap_counter.h"
+#include "metrics.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace utf
+{
+namespace aux
+{
+
+// Constant-initialized, so allocations made before main() are counted too
+constinit static metrics::counter s_heap_allocs;
+
+uint64_t heap_allocs()
+{
+    return s_heap_allocs.value();
+}
+
+static void* counted_alloc(std::size_t size)
+{
+    s_heap_allocs.add();
+    return std::malloc(size > 0 ? size : 1);
+}
+
+static void* counted_aligned_alloc(std::size_t size, std::align_val_t al)
+{
+    s_heap_allocs.add();
+
+    // aligned_alloc() wants the size to be a multiple of the alignment
+    auto align = static_cast<std::size_t>(al);
+    return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+}
+}
+
+// Array and nothrow forms go through these ones
+void* operator new(std::size_t size)
+{
+    void* ptr = utf::aux::counted_alloc(size);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(std::size_t size, std::align_val_t al)
+{
+    void* ptr = utf::aux::counted_aligned_alloc(size, al);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {std::free(ptr);}
+void operator delete(void* ptr, std::size_t) noexcept {std::free(ptr);}
+void operator delete(void* ptr, std::align_val_t) noexcept {std::free(ptr);}
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {std::free(ptr);}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+namespace utf
+{
+namespace aux
+{
+
+// Calls to the global operator new in the whole process so far, every thread included.
+// Counting is done by replacements of the global operator new / delete, defined next to this function.
+// Those are built into the forwarder executable only (not the core library), other programs don't count.
+// Memory taken with malloc() directly (e.g. by C libraries) isn't counted.
+uint64_t heap_allocs();
+
+}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+
+// Log-linear histogram of non-negative values (HDR-style): values below 1024 are counted exactly,
+// larger ones by their 10 most significant bits, so a percentile is off by less than 0.2%.
+// Memory depends on the largest value only, not on how many values are recorded.
+class latency_histogram
+{
+public:
+    void record(uint64_t value, uint64_t times = 1)
+    {
+        if(times == 0)
+            return;
+
+        size_t idx = index(value);
+        if(idx >= m_counts.size())
+            m_counts.resize(idx + 1, 0);
+
+        m_counts[idx] += times;
+        m_count += times;
+        m_max = std::max(m_max, value);
+    }
+
+    void merge(const latency_histogram& other)
+    {
+        if(other.m_counts.size() > m_counts.size())
+            m_counts.resize(other.m_counts.size(), 0);
+
+        for(size_t i = 0; i < other.m_counts.size(); ++i)
+            m_counts[i] += other.m_counts[i];
+        m_count += other.m_count;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    void clear()
+    {
+        m_counts.clear();
+        m_count = 0;
+        m_max = 0;
+    }
+
+    // Smallest recorded value that at least pct percent of values don't exceed
+    // (up to the bucket's precision), 0 if nothing is recorded
+    uint64_t percentile(double pct) const
+    {
+        if(m_count == 0)
+            return 0;
+
+        double clamped = std::clamp(pct, 0.0, 100.0);
+        uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(clamped / 100.0 * m_count)), 1);
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if(seen >= rank)
+                return std::min(highest_in_bucket(i), m_max);
+        }
+        return m_max;
+    }
+
+    uint64_t count() const {return m_count;}
+    uint64_t max() const {return m_max;}
+
+    // Bucket of a value. Every power of two above SUB_COUNT gets HALF_SUB_COUNT buckets
+    static constexpr size_t index(uint64_t value)
+    {
+        if(value < SUB_COUNT)
+            return value;
+
+        unsigned shift = std::bit_width(value) - SUB_BITS;
+        return shift * HALF_SUB_COUNT + (value >> shift);
+    }
+
+    // Largest value counted in the bucket
+    static constexpr uint64_t highest_in_bucket(size_t idx)
+    {
+        if(idx < SUB_COUNT)
+            return idx;
+
+        unsigned shift = idx / HALF_SUB_COUNT - 1;
+        uint64_t mantissa = idx - shift * HALF_SUB_COUNT;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    static constexpr unsigned SUB_BITS = 10;
+    static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+    static constexpr uint64_t HALF_SUB_COUNT = SUB_COUNT / 2;
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+}
+}
@@ -0,0 +1,195 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <iterator>
+#include <stdexcept>
+
+namespace utf
+{
+namespace aux
+{
+namespace metrics
+{
+
+static constexpr double SUMMARY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+registry& registry::global()
+{
+    static registry reg;
+    return reg;
+}
+
+counter& registry::make_counter(const std::string& name, const std::string& help, const labels_t& labels)
+{
+    auto& s = find_or_add(name, help, metric_t::counter, 1.0, labels);
+    return *s.cnt;
+}
+
+gauge& registry::make_gauge(const std::string& name, const std::string& help, const labels_t& labels)
+{
+    auto& s = find_or_add(name, help, metric_t::gauge, 1.0, labels);
+    return *s.gge;
+}
+
+histogram& registry::make_histogram(const std::string& name, const std::string& help, double scale, const labels_t& labels)
+{
+    auto& s = find_or_add(name, help, metric_t::summary, scale, labels);
+    return *s.hist;
+}
+
+registry::series& registry::find_or_add(
+    const std::string& name, const std::string& help, metric_t type, double scale, const labels_t& labels)
+{
+    std::lock_guard l(m_mx);
+
+    auto fam = std::find_if(m_families.begin(), m_families.end(), [&name](const family& f){return f.name == name;});
+    if(fam == m_families.end())
+    {
+        m_families.push_back(family{name, help, type, scale, {}});
+        fam = std::prev(m_families.end());
+    }
+    else if(fam->type != type)
+    {
+        throw std::runtime_error("metrics: " + name + " is registered with another type");
+    }
+
+    for(auto& s : fam->members)
+    {
+        if(s.labels == labels)
+            return s;
+    }
+
+    series s{labels, nullptr, nullptr, nullptr};
+    switch(type)
+    {
+        case metric_t::counter:
+            s.cnt = std::make_unique<counter>();
+            break;
+        case metric_t::gauge:
+            s.gge = std::make_unique<gauge>();
+            break;
+        case metric_t::summary:
+            s.hist = std::make_unique<histogram>();
+            break;
+    }
+    fam->members.push_back(std::move(s));
+    return fam->members.back();
+}
+
+// Appends {name="value",...}, with an optional extra label
+static void render_labels(std::string& out, const labels_t& labels, const char* extra_name = nullptr, const std::string& extra_value = {})
+{
+    if(labels.empty() && extra_name == nullptr)
+        return;
+
+    auto append_label = [&out](const std::string& name, const std::string& value)
+    {
+        out += name;
+        out += "=\"";
+        for(char c : value)
+        {
+            if(c == '\\' || c == '"')
+                out += '\\';
+            if(c == '\n')
+            {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        out += '"';
+    };
+
+    out += '{';
+    for(size_t i = 0; i < labels.size(); ++i)
+    {
+        if(i > 0)
+            out += ',';
+        append_label(labels[i].first, labels[i].second);
+    }
+    if(extra_name != nullptr)
+    {
+        if(!labels.empty())
+            out += ',';
+        append_label(extra_name, extra_value);
+    }
+    out += '}';
+}
+
+static std::string format_number(double v)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+uint64_t registry::add_collector(std::function<void()> collector)
+{
+    std::lock_guard l(m_mx);
+    m_collectors.emplace_back(m_next_collector_id, std::move(collector));
+    return m_next_collector_id++;
+}
+
+void registry::remove_collector(uint64_t id)
+{
+    std::lock_guard l(m_mx);
+    std::erase_if(m_collectors, [id](const auto& c){return c.first == id;});
+}
+
+std::string registry::render() const
+{
+    std::lock_guard l(m_mx);
+
+    for(const auto& [id, collect] : m_collectors)
+        collect();
+
+    std::string out;
+    for(const auto& fam : m_families)
+    {
+        out += "# HELP " + fam.name + " " + fam.help + "\n";
+        out += "# TYPE " + fam.name + " ";
+        switch(fam.type)
+        {
+            case metric_t::counter: out += "counter\n"; break;
+            case metric_t::gauge: out += "gauge\n"; break;
+            case metric_t::summary: out += "summary\n"; break;
+        }
+
+        for(const auto& s : fam.members)
+        {
+            if(fam.type == metric_t::counter || fam.type == metric_t::gauge)
+            {
+                out += fam.name;
+                render_labels(out, s.labels);
+                out += ' ';
+                out += fam.type == metric_t::counter ?
+                    std::to_string(s.cnt->value()) : std::to_string(s.gge->value());
+                out += '\n';
+                continue;
+            }
+
+            auto snap = s.hist->snapshot();
+            for(double q : SUMMARY_QUANTILES)
+            {
+                out += fam.name;
+                render_labels(out, s.labels, "quantile", format_number(q));
+                out += ' ';
+                out += snap.count() > 0 ? format_number(snap.percentile(q * 100.0) / fam.scale) : "NaN";
+                out += '\n';
+            }
+
+            out += fam.name + "_sum";
+            render_labels(out, s.labels);
+            out += ' ' + format_number(s.hist->sum() / fam.scale) + '\n';
+
+            out += fam.name + "_count";
+            render_labels(out, s.labels);
+            out += ' ' + std::to_string(snap.count()) + '\n';
+        }
+    }
+    return out;
+}
+
+}
+}
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+namespace metrics
+{
+
+using labels_t = std::vector<std::pair<std::string, std::string>>;
+
+// Counters are split into this many cache line sized shards
+constexpr size_t COUNTER_SHARDS = 16;
+
+// Values recorded by histograms are clamped to this (about 71 minutes in microseconds)
+constexpr uint64_t MAX_HISTOGRAM_VALUE = (uint64_t(1) << 32) - 1;
+
+// Shard of the calling thread, threads get consecutive shards as they first ask
+inline size_t thread_shard()
+{
+    static std::atomic_size_t next_shard = 0;
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % COUNTER_SHARDS;
+    return shard;
+}
+
+// Monotonic counter, every thread adds to a shard of its own, so recording threads don't share cache lines
+class counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        m_shards[thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t sum = 0;
+        for(const auto& shard : m_shards)
+            sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    struct alignas(64) shard
+    {
+        std::atomic_uint64_t value = 0;
+    };
+
+    shard m_shards[COUNTER_SHARDS];
+};
+
+// Current value of something, set by its owner
+class gauge
+{
+public:
+    void set(int64_t v) {m_value.store(v, std::memory_order_relaxed);}
+    void add(int64_t n) {m_value.fetch_add(n, std::memory_order_relaxed);}
+
+    int64_t value() const {return m_value.load(std::memory_order_relaxed);}
+
+private:
+    std::atomic_int64_t m_value = 0;
+};
+
+// Buckets of latency_histogram as relaxed atomics, preallocated up to MAX_HISTOGRAM_VALUE,
+// so recording is a bucket lookup and an increment
+class histogram
+{
+public:
+    histogram() :
+        m_buckets(std::make_unique<std::atomic_uint64_t[]>(BUCKETS_COUNT))
+    {}
+
+    void record(uint64_t value)
+    {
+        value = std::min(value, MAX_HISTOGRAM_VALUE);
+        m_buckets[latency_histogram::index(value)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while(value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+    }
+
+    // Values recorded so far, concurrent records may or may not be included
+    latency_histogram snapshot() const
+    {
+        latency_histogram res;
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < BUCKETS_COUNT; ++i)
+        {
+            uint64_t times = m_buckets[i].load(std::memory_order_relaxed);
+            if(times > 0)
+                res.record(std::min(latency_histogram::highest_in_bucket(i), max), times);
+        }
+        return res;
+    }
+
+    uint64_t sum() const {return m_sum.load(std::memory_order_relaxed);}
+
+private:
+    static constexpr size_t BUCKETS_COUNT = latency_histogram::index(MAX_HISTOGRAM_VALUE) + 1;
+
+    std::unique_ptr<std::atomic_uint64_t[]> m_buckets;
+    std::atomic_uint64_t m_sum = 0;
+    std::atomic_uint64_t m_max = 0;
+};
+
+// Owns every metric of the process. Metrics are created once, at startup, and live as long
+// as the registry does, so components keep plain references to them.
+// Asking for an existing name and labels returns the existing metric.
+class registry
+{
+public:
+    static registry& global();
+
+    counter& make_counter(const std::string& name, const std::string& help, const labels_t& labels = {});
+    gauge& make_gauge(const std::string& name, const std::string& help, const labels_t& labels = {});
+
+    // Exposed as a summary, values are divided by scale (e.g. 1e6 for microseconds to seconds)
+    histogram& make_histogram(const std::string& name, const std::string& help, double scale, const labels_t& labels = {});
+
+    // Called by render() before anything is rendered, for values that are read on demand
+    // (e.g. setting gauges from statistics kept elsewhere). Must not call the registry.
+    // Returns an id for remove_collector(), needed if the collector refers to something short-lived.
+    uint64_t add_collector(std::function<void()> collector);
+
+    // Once it returns, the collector isn't running and won't be called again
+    void remove_collector(uint64_t id);
+
+    // Every metric in Prometheus text exposition format
+    std::string render() const;
+
+private:
+    enum class metric_t
+    {
+        counter,
+        gauge,
+        summary
+    };
+
+    struct series
+    {
+        labels_t labels;
+        std::unique_ptr<counter> cnt;
+        std::unique_ptr<gauge> gge;
+        std::unique_ptr<histogram> hist;
+    };
+
+    struct family
+    {
+        std::string name;
+        std::string help;
+        metric_t type;
+        double scale = 1.0;
+        std::vector<series> members;
+    };
+
+    series& find_or_add(const std::string& name, const std::string& help, metric_t type, double scale, const labels_t& labels);
+
+    mutable std::mutex m_mx;
+    std::vector<family> m_families;
+    std::vector<std::pair<uint64_t, std::function<void()>>> m_collectors;
+    uint64_t m_next_collector_id = 0;
+};
+
+}
+}
+}
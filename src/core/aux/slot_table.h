@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+
+// Slab of values addressed by 64-bit keys: the low half of a key is the slot index,
+// the high half is the slot's generation. Insert, lookup and erase are O(1),
+// freed slots are reused through an intrusive free list, so the steady state doesn't allocate.
+// Every reuse of a slot bumps its generation, so a stale key (e.g. a late answer
+// to an erased entry) doesn't match the new occupant. Odd generation means the slot is taken.
+template<typename T>
+class slot_table
+{
+public:
+    slot_table() = default;
+
+    explicit slot_table(size_t capacity)
+    {
+        m_slots.reserve(capacity);
+    }
+
+    // Store a value, returns its key
+    uint64_t insert(const T& value)
+    {
+        uint32_t idx;
+        if(m_free_head != NO_SLOT)
+        {
+            idx = m_free_head;
+            m_free_head = m_slots[idx].next_free;
+        }
+        else
+        {
+            idx = static_cast<uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        }
+
+        auto& s = m_slots[idx];
+        s.value = value;
+        ++s.generation;
+        ++m_size;
+        return make_key(idx, s.generation);
+    }
+
+    // Value stored under the key, nullptr if the key is stale or unknown
+    T* find(uint64_t key)
+    {
+        uint32_t idx = static_cast<uint32_t>(key);
+        if(idx >= m_slots.size() || m_slots[idx].generation != static_cast<uint32_t>(key >> 32))
+            return nullptr;
+        return &m_slots[idx].value;
+    }
+
+    // Free the slot, returns false if the key is stale or unknown
+    bool erase(uint64_t key)
+    {
+        if(find(key) == nullptr)
+            return false;
+
+        uint32_t idx = static_cast<uint32_t>(key);
+        auto& s = m_slots[idx];
+        ++s.generation;
+        s.next_free = m_free_head;
+        m_free_head = idx;
+        --m_size;
+        return true;
+    }
+
+    // Call f(key, value) for every stored value
+    template<typename F>
+    void for_each(F&& f)
+    {
+        for(uint32_t idx = 0; idx < m_slots.size(); ++idx)
+        {
+            auto& s = m_slots[idx];
+            if(s.generation & 1)
+                f(make_key(idx, s.generation), s.value);
+        }
+    }
+
+    size_t size() const {return m_size;}
+
+private:
+    static constexpr uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+
+    struct slot
+    {
+        T value{};
+        uint32_t generation = 0;
+        uint32_t next_free = NO_SLOT;
+    };
+
+    static uint64_t make_key(uint32_t idx, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | idx;
+    }
+
+    std::vector<slot> m_slots;
+    uint32_t m_free_head = NO_SLOT;
+    size_t m_size = 0;
+};
+
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+
+// Largest CPU index a thread can be pinned to
+constexpr uint32_t MAX_CPU_INDEX = CPU_SETSIZE - 1;
+
+// CPUs and memory policy of the threads of one role (UDP, TCP, forwarder, EDR writer)
+struct thread_placement
+{
+    // Thread i of the role is pinned to cpus[i % cpus.size()], one CPU per thread.
+    // Empty leaves the threads to the scheduler.
+    std::vector<uint32_t> cpus;
+
+    // Memory is allocated on the NUMA node the thread runs on,
+    // even if the process was started with another policy (e.g. by numactl --interleave).
+    // Applies to what the thread allocates after it's placed, not to what was built for it beforehand.
+    bool numa_local = false;
+};
+
+// Applies the placement to the calling thread, which is the thread_idx-th of its role.
+// Returns false if the system refused any part of it.
+inline bool place_current_thread(const thread_placement& placement, size_t thread_idx)
+{
+    bool is_ok = true;
+
+    if(!placement.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(placement.cpus[thread_idx % placement.cpus.size()], &set);
+        is_ok = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    // No libnuma dependency for a single call
+    if(placement.numa_local)
+        is_ok = ::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) == 0 && is_ok;
+
+    return is_ok;
+}
+
+}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace utf
+{
+namespace aux
+{
+
+// Hashed timing wheel: keys are put into the slot of their expiry tick,
+// so both adding and expiring a key are O(1). Keys that expire more than
+// one revolution ahead simply stay in their slot until their lap comes.
+// There is no explicit cancellation: owners are expected to remember which keys
+// are still alive and ignore the rest when they expire (lazy deletion).
+template<typename Key>
+class timing_wheel
+{
+public:
+    explicit timing_wheel(size_t slots_count) :
+        m_slots(std::max<size_t>(slots_count, 2))
+    {}
+
+    // Schedule a key to expire at the given tick,
+    // ticks that have already passed expire on the next advance()
+    void add(const Key& key, uint64_t expiry_tick)
+    {
+        uint64_t slot_tick = std::max(expiry_tick, m_curr_tick + 1);
+        m_slots[slot_tick % m_slots.size()].push_back(entry{key, expiry_tick});
+        ++m_size;
+    }
+
+    // Move the wheel to the given tick, calling on_expire(key, expiry_tick) for every key due
+    template<typename F>
+    void advance(uint64_t now_tick, F&& on_expire)
+    {
+        if(now_tick <= m_curr_tick)
+            return;
+
+        // No need to visit a slot more than once per call
+        uint64_t steps = std::min<uint64_t>(now_tick - m_curr_tick, m_slots.size());
+        for(uint64_t i = 1; i <= steps; ++i)
+        {
+            auto& slot = m_slots[(m_curr_tick + i) % m_slots.size()];
+
+            // Expire due entries, compact the rest in place
+            size_t kept = 0;
+            for(size_t j = 0; j < slot.size(); ++j)
+            {
+                if(slot[j].expiry_tick <= now_tick)
+                {
+                    on_expire(slot[j].key, slot[j].expiry_tick);
+                    --m_size;
+                }
+                else
+                {
+                    slot[kept++] = slot[j];
+                }
+            }
+
+            // Keeps capacity, so steady state doesn't allocate
+            slot.resize(kept);
+        }
+        m_curr_tick = now_tick;
+    }
+
+    void clear()
+    {
+        for(auto& slot : m_slots)
+            slot.clear();
+        m_size = 0;
+    }
+
+    uint64_t current_tick() const {return m_curr_tick;}
+    size_t size() const {return m_size;}
+
+private:
+    struct entry
+    {
+        Key key;
+        uint64_t expiry_tick;
+    };
+
+    std::vector<std::vector<entry>> m_slots;
+    uint64_t m_curr_tick = 0;
+    size_t m_size = 0;
+};
+
+}
+}
@@ -25,6 +25,13 @@ enum endpoint_t
     server
 };
 
+// How UDP servers and TCP clients do their I/O
+enum class io_engine
+{
+    asio,       // Reactor of boost::asio (epoll)
+    io_uring    // io_uring completions, falls back to asio where io_uring is unavailable
+};
+
 struct net_recv_frame
 {
     boost::asio::ip::address_v4 sender_addr;
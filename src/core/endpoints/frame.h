@@ -0,0 +1,152 @@
+#pragma once
+
+#include "utf_core.h"
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace utf
+{
+namespace endpoints
+{
+
+// Every message on a TCP connection is prefixed with this header (host byte order):
+// [payload size : 4 bytes][request ID : 8 bytes][payload : <payload size> bytes]
+struct frame_header
+{
+    uint32_t payload_size;
+    uint64_t request_id;
+};
+
+constexpr size_t FRAME_HEADER_SIZE = sizeof(frame_header::payload_size) + sizeof(frame_header::request_id);
+constexpr uint32_t MAX_FRAME_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+inline void write_frame_header(char* dest, const frame_header& hdr)
+{
+    std::memcpy(dest, &hdr.payload_size, sizeof(hdr.payload_size));
+    std::memcpy(dest + sizeof(hdr.payload_size), &hdr.request_id, sizeof(hdr.request_id));
+}
+
+inline frame_header read_frame_header(const char* src)
+{
+    frame_header hdr;
+    std::memcpy(&hdr.payload_size, src, sizeof(hdr.payload_size));
+    std::memcpy(&hdr.request_id, src + sizeof(hdr.payload_size), sizeof(hdr.request_id));
+    return hdr;
+}
+
+// Receive buffer for a framed byte stream.
+// Reads are appended at the tail and complete frames are parsed from the head in place,
+// so a single read may yield any number of frames. Only the trailing partial frame
+// is ever moved (to the front of the storage), and the storage grows when a frame
+// does not fit into it.
+class frame_buffer
+{
+public:
+    explicit frame_buffer(size_t capacity = 4096) :
+        m_data(capacity < MIN_FREE_SPACE ? MIN_FREE_SPACE : capacity)
+    {}
+
+    // Free space for the next read
+    boost::asio::mutable_buffer prepare()
+    {
+        if(m_head == m_tail)
+        {
+            m_head = m_tail = 0;
+        }
+
+        size_t free_space = m_data.size() - m_tail;
+        if(free_space < MIN_FREE_SPACE || m_head + m_need > m_data.size())
+        {
+            // Move the partial frame to the front
+            if(m_head > 0)
+            {
+                std::memmove(m_data.data(), m_data.data() + m_head, m_tail - m_head);
+                m_tail -= m_head;
+                m_head = 0;
+            }
+
+            // Grow if the pending frame (or a reasonable read) still doesn't fit
+            size_t required = std::max(m_need, m_tail + MIN_FREE_SPACE);
+            if(required > m_data.size())
+            {
+                size_t new_size = m_data.size();
+                while(new_size < required)
+                    new_size *= 2;
+                m_data.resize(new_size);
+            }
+        }
+
+        return boost::asio::buffer(m_data.data() + m_tail, m_data.size() - m_tail);
+    }
+
+    // Account for bytes written into the buffer returned by prepare()
+    void commit(size_t bytes_count)
+    {
+        m_tail += bytes_count;
+    }
+
+    // Calls handler(const frame_header&, const char* payload_begin, const char* payload_end)
+    // for every complete frame. Payload pointers are valid only during the call.
+    // Returns false when a malformed frame is encountered.
+    template<typename Handler>
+    bool consume(Handler&& handler)
+    {
+        for(;;)
+        {
+            size_t avail = m_tail - m_head;
+            if(avail < FRAME_HEADER_SIZE)
+            {
+                m_need = FRAME_HEADER_SIZE;
+                break;
+            }
+
+            const char* frame = m_data.data() + m_head;
+            frame_header hdr = read_frame_header(frame);
+            if(hdr.payload_size > MAX_FRAME_PAYLOAD_SIZE)
+                return false;
+
+            size_t frame_size = FRAME_HEADER_SIZE + hdr.payload_size;
+            if(avail < frame_size)
+            {
+                m_need = frame_size;
+                break;
+            }
+
+            handler(hdr, frame + FRAME_HEADER_SIZE, frame + frame_size);
+            m_head += frame_size;
+        }
+
+        if(m_head == m_tail)
+        {
+            m_head = m_tail = 0;
+        }
+        return true;
+    }
+
+    void reset()
+    {
+        m_head = m_tail = 0;
+        m_need = FRAME_HEADER_SIZE;
+    }
+
+    size_t size() const {return m_tail - m_head;}
+    size_t capacity() const {return m_data.size();}
+
+private:
+    static constexpr size_t MIN_FREE_SPACE = 512;
+
+    std::vector<char> m_data;
+    size_t m_head = 0;
+    size_t m_tail = 0;
+
+    // Bytes needed at m_head to make progress
+    size_t m_need = FRAME_HEADER_SIZE;
+};
+
+}
+}
@@ -0,0 +1,362 @@
+#include "uring.h"
+#include "metrics.h"
+
+#include <boost/asio/io_context.hpp>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace utf
+{
+namespace endpoints
+{
+
+static int uring_setup(uint32_t entries, io_uring_params* params)
+{
+    return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, uint32_t to_submit, uint32_t wait_nr)
+{
+    return ::syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr,
+        wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+}
+
+static int uring_register(int ring_fd, uint32_t opcode, const void* arg, uint32_t nr_args)
+{
+    return ::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static std::runtime_error uring_error(const char* what)
+{
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+bool uring::is_supported()
+{
+    static const bool is_ok = []()
+    {
+        io_uring_params params{};
+        int ring_fd = uring_setup(4, &params);
+        if(ring_fd < 0)
+            return false;
+
+        // Zero-copy send came with multishot recvmsg (6.0), it tells whether the latter is there
+        std::vector<char> probe_mem(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(probe_mem.data());
+        bool has_ops = uring_register(ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+            probe->last_op >= IORING_OP_SEND_ZC &&
+            (probe->ops[IORING_OP_PROVIDE_BUFFERS].flags & IO_URING_OP_SUPPORTED);
+
+        ::close(ring_fd);
+        return has_ops;
+    }();
+
+    return is_ok;
+}
+
+uring::uring(const boost::asio::any_io_executor& ex, uint32_t entries) :
+    m_event_desc(ex)
+{
+    // Completion queue is larger, multishot receives post many completions per submission
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    m_ring_fd = uring_setup(entries, &params);
+    if(m_ring_fd < 0)
+        throw uring_error("io_uring_setup");
+
+    try
+    {
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_sq_ring = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ring_fd, IORING_OFF_SQ_RING);
+        if(m_sq_ring == MAP_FAILED)
+        {
+            m_sq_ring = nullptr;
+            throw uring_error("Mapping submission ring");
+        }
+
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_cq_ring = ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ring_fd, IORING_OFF_CQ_RING);
+        if(m_cq_ring == MAP_FAILED)
+        {
+            m_cq_ring = nullptr;
+            throw uring_error("Mapping completion ring");
+        }
+
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ring_fd, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED)
+            throw uring_error("Mapping submission entries");
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<char*>(m_sq_ring);
+        m_sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+
+        // Submission entries are used in ring order, the index array is an identity map
+        auto* sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        for(uint32_t i = 0; i < m_sq_entries; ++i)
+            sq_array[i] = i;
+
+        auto* cq = static_cast<char*>(m_cq_ring);
+        m_cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        m_event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(m_event_fd < 0)
+            throw uring_error("eventfd");
+        if(uring_register(m_ring_fd, IORING_REGISTER_EVENTFD, &m_event_fd, 1) < 0)
+            throw uring_error("Registering eventfd");
+
+        m_event_desc.assign(m_event_fd);
+    }
+    catch(...)
+    {
+        release();
+        throw;
+    }
+}
+
+uring::~uring()
+{
+    release();
+}
+
+void uring::release()
+{
+    // Closing the ring cancels whatever is still in flight
+    if(m_event_desc.is_open())
+    {
+        boost::system::error_code ec;
+        m_event_desc.close(ec);
+        m_event_fd = -1;
+    }
+    if(m_event_fd >= 0)
+        ::close(m_event_fd);
+
+    if(m_sqes)
+        ::munmap(m_sqes, m_sqes_size);
+    if(m_cq_ring)
+        ::munmap(m_cq_ring, m_cq_ring_size);
+    if(m_sq_ring)
+        ::munmap(m_sq_ring, m_sq_ring_size);
+    if(m_ring_fd >= 0)
+        ::close(m_ring_fd);
+
+    m_event_fd = m_ring_fd = -1;
+    m_sqes = nullptr;
+    m_cq_ring = m_sq_ring = nullptr;
+}
+
+io_uring_sqe* uring::get_sqe()
+{
+    uint32_t head = std::atomic_ref<uint32_t>(*m_sq_head).load(std::memory_order_acquire);
+    uint32_t tail = *m_sq_tail + m_pending;
+    if(tail - head >= m_sq_entries)
+    {
+        submit();
+        head = std::atomic_ref<uint32_t>(*m_sq_head).load(std::memory_order_acquire);
+        tail = *m_sq_tail + m_pending;
+        if(tail - head >= m_sq_entries)
+            return nullptr;
+    }
+
+    auto* sqe = &m_sqes[tail & m_sq_mask];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    ++m_pending;
+    return sqe;
+}
+
+int uring::submit(uint32_t wait_nr)
+{
+    // Entries become visible to the kernel with the tail
+    if(m_pending > 0)
+    {
+        std::atomic_ref<uint32_t>(*m_sq_tail).store(*m_sq_tail + m_pending, std::memory_order_release);
+        m_pending = 0;
+    }
+
+    // Entries left over by a failed call are submitted too
+    uint32_t to_submit = *m_sq_tail - std::atomic_ref<uint32_t>(*m_sq_head).load(std::memory_order_acquire);
+    if(to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    int submitted = uring_enter(m_ring_fd, to_submit, wait_nr);
+    if(submitted < 0)
+    {
+        // Completion queue is full or a signal came, the entries stay queued for the next call
+        if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return 0;
+        return -errno;
+    }
+    return submitted;
+}
+
+void uring::cancel()
+{
+    boost::system::error_code ec;
+    m_event_desc.cancel(ec);
+}
+
+// Some kernels accept buffer rings but never select from them, try one for real
+static bool buffer_rings_work()
+{
+    static const bool is_ok = []()
+    {
+        int pipe_fds[2];
+        if(::pipe(pipe_fds) != 0)
+            return false;
+
+        bool is_selected = false;
+        void* br_mem = ::mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        try
+        {
+            boost::asio::io_context ioc;
+            uring ring(ioc.get_executor(), 4);
+
+            io_uring_buf_reg reg{};
+            reg.ring_addr = reinterpret_cast<uint64_t>(br_mem);
+            reg.ring_entries = 1;
+
+            // A short write leaves nothing to select a buffer for, buffer rings are taken as broken then
+            bool has_data = ::write(pipe_fds[1], "probe", 5) == 5;
+            if(has_data && br_mem != MAP_FAILED && uring_register(ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) == 0)
+            {
+                char buf[8];
+                auto* br = static_cast<io_uring_buf_ring*>(br_mem);
+                br->bufs[0].addr = reinterpret_cast<uint64_t>(buf);
+                br->bufs[0].len = sizeof(buf);
+                br->bufs[0].bid = 0;
+                std::atomic_ref<uint16_t>(br->tail).store(1, std::memory_order_release);
+
+                auto* sqe = ring.get_sqe();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = pipe_fds[0];
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+                if(ring.submit(1) > 0)
+                    ring.reap([&is_selected](const io_uring_cqe& cqe){is_selected = cqe.res > 0;});
+
+                uring_register(ring.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+            }
+        }
+        catch(const std::exception&)
+        {}
+
+        if(br_mem != MAP_FAILED)
+            ::munmap(br_mem, 4096);
+        ::close(pipe_fds[0]);
+        ::close(pipe_fds[1]);
+        return is_selected;
+    }();
+
+    return is_ok;
+}
+
+void count_engine_endpoint(io_engine engine)
+{
+    aux::metrics::registry::global().make_gauge(
+        "utf_io_engine_endpoints", "UDP sockets and TCP connections driven by every I/O engine",
+        {{"engine", engine == io_engine::io_uring ? "io_uring" : "asio"}}
+    ).add(1);
+}
+
+uring_buffer_ring::uring_buffer_ring(uring& ring, uint16_t group_id, uint16_t count, size_t buf_size) :
+    m_ring(ring),
+    m_group_id(group_id),
+    m_mask(count - 1),
+    m_buf_size(buf_size),
+    m_data(static_cast<size_t>(count) * buf_size)
+{
+    if(count == 0 || (count & m_mask) != 0)
+        throw std::runtime_error("Buffer ring size must be a power of 2");
+
+    if(!buffer_rings_work())
+    {
+        // Every buffer is handed over by a single request
+        m_is_legacy = true;
+        auto* sqe = m_ring.get_sqe();
+        if(!sqe)
+            throw std::runtime_error("Submission queue is full");
+        provide(sqe, 0, count);
+        return;
+    }
+
+    // The ring itself has to be page aligned
+    m_br_size = count * sizeof(io_uring_buf);
+    void* br = ::mmap(nullptr, m_br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(br == MAP_FAILED)
+        throw uring_error("Mapping buffer ring");
+    m_br = static_cast<io_uring_buf_ring*>(br);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(m_br);
+    reg.ring_entries = count;
+    reg.bgid = group_id;
+    if(uring_register(m_ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        auto err = uring_error("Registering buffer ring");
+        ::munmap(m_br, m_br_size);
+        throw err;
+    }
+
+    for(uint16_t i = 0; i < count; ++i)
+        recycle(i);
+}
+
+uring_buffer_ring::~uring_buffer_ring()
+{
+    // The ring is gone by now, buffers were unregistered along with it
+    if(m_br)
+        ::munmap(m_br, m_br_size);
+}
+
+void uring_buffer_ring::provide(io_uring_sqe* sqe, uint16_t first_id, uint16_t count)
+{
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = reinterpret_cast<uint64_t>(m_data.data() + first_id * m_buf_size);
+    sqe->len = m_buf_size;
+    sqe->off = first_id;
+    sqe->buf_group = m_group_id;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = PROVIDE_USER_DATA;
+}
+
+void uring_buffer_ring::recycle(uint16_t buf_id)
+{
+    if(m_is_legacy)
+    {
+        // Goes to the kernel with the owner's next submission
+        auto* sqe = m_ring.get_sqe();
+        if(sqe)
+            provide(sqe, buf_id, 1);
+        return;
+    }
+
+    auto& buf = m_br->bufs[m_tail & m_mask];
+    buf.addr = reinterpret_cast<uint64_t>(m_data.data() + buf_id * m_buf_size);
+    buf.len = m_buf_size;
+    buf.bid = buf_id;
+
+    // The kernel picks buffers up to the tail
+    ++m_tail;
+    std::atomic_ref<uint16_t>(m_br->tail).store(m_tail, std::memory_order_release);
+}
+
+}
+}
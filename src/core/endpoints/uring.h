@@ -0,0 +1,181 @@
+#pragma once
+
+#include "endpoint.h"
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utf
+{
+namespace endpoints
+{
+
+// Submission and completion rings of io_uring, set up with raw system calls (no liburing).
+// Entries queued with get_sqe() go to the kernel together on submit(), completions are
+// signalled through an eventfd which is waited for on the owner's executor,
+// so the ring is driven by the same io_context (or strand) as the rest of the owner.
+// Not thread-safe, the owner serializes every call.
+class uring
+{
+public:
+    // Throws std::runtime_error if the ring can't be set up
+    uring(const boost::asio::any_io_executor& ex, uint32_t entries);
+    ~uring();
+
+    uring(const uring& other) = delete;
+    uring& operator=(const uring& other) = delete;
+
+    // Whether the kernel provides io_uring with multishot receives (6.0+), checked once
+    static bool is_supported();
+
+    // Cleared submission entry, queued entries are submitted first if the queue is full.
+    // Null if the kernel doesn't take entries (completion queue overflow).
+    io_uring_sqe* get_sqe();
+
+    // Hands every queued entry over to the kernel with a single system call,
+    // and waits for wait_nr completions. Returns the number of entries taken or -errno.
+    int submit(uint32_t wait_nr = 0);
+
+    // Calls handler(const io_uring_cqe&) for every available completion, returns their count
+    template<typename Handler>
+    size_t reap(Handler&& handler);
+
+    // handler() is called once there are completions to reap, the wait has to be renewed after that
+    template<typename Handler>
+    void async_wait(Handler&& handler);
+
+    // Aborts the wait for completions, requests in flight are released with the ring
+    void cancel();
+
+    int fd() const {return m_ring_fd;}
+
+private:
+    void release();
+
+    int m_ring_fd = -1;
+    int m_event_fd = -1;
+    boost::asio::posix::stream_descriptor m_event_desc;
+
+    void* m_sq_ring = nullptr;
+    size_t m_sq_ring_size = 0;
+    void* m_cq_ring = nullptr;
+    size_t m_cq_ring_size = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqes_size = 0;
+
+    uint32_t* m_sq_head = nullptr;
+    uint32_t* m_sq_tail = nullptr;
+    uint32_t m_sq_mask = 0;
+    uint32_t m_sq_entries = 0;
+
+    uint32_t* m_cq_head = nullptr;
+    uint32_t* m_cq_tail = nullptr;
+    uint32_t m_cq_mask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    // Entries queued since the last submission
+    uint32_t m_pending = 0;
+};
+
+// Receive buffers the kernel picks from (provided buffer ring), a buffer is
+// owned by the application from its completion until it's recycled.
+// Where buffer rings don't work, buffers are handed over by IORING_OP_PROVIDE_BUFFERS requests
+// queued on the ring, whose completions (PROVIDE_USER_DATA) are to be ignored.
+// The ring has to be released first, the kernel may write into the buffers for as long as it's open.
+class uring_buffer_ring
+{
+public:
+    static constexpr uint64_t PROVIDE_USER_DATA = UINT64_MAX;
+
+    // count must be a power of 2, throws std::runtime_error if the buffers can't be provided
+    uring_buffer_ring(uring& ring, uint16_t group_id, uint16_t count, size_t buf_size);
+    ~uring_buffer_ring();
+
+    uring_buffer_ring(const uring_buffer_ring& other) = delete;
+    uring_buffer_ring& operator=(const uring_buffer_ring& other) = delete;
+
+    uint16_t group_id() const {return m_group_id;}
+    size_t buffer_size() const {return m_buf_size;}
+
+    // Buffer selected by a completion (IORING_CQE_F_BUFFER)
+    const char* buffer(uint16_t buf_id) const {return m_data.data() + buf_id * m_buf_size;}
+
+    // Gives the buffer back to the kernel
+    void recycle(uint16_t buf_id);
+
+    // False if buffers are provided by requests instead
+    bool is_ring_mapped() const {return !m_is_legacy;}
+
+private:
+    void provide(io_uring_sqe* sqe, uint16_t first_id, uint16_t count);
+
+    uring& m_ring;
+    io_uring_buf_ring* m_br = nullptr;
+    size_t m_br_size = 0;
+
+    uint16_t m_group_id;
+    uint16_t m_mask;
+    uint16_t m_tail = 0;
+    bool m_is_legacy = false;
+    size_t m_buf_size;
+    std::vector<char> m_data;
+};
+
+// Counts a UDP socket or a TCP connection as driven by the engine it ended up with,
+// so that falling back to asio shows in the utf_io_engine_endpoints gauge
+void count_engine_endpoint(io_engine engine);
+
+template<typename Handler>
+size_t uring::reap(Handler&& handler)
+{
+    size_t count = 0;
+    uint32_t head = *m_cq_head;
+    uint32_t tail = std::atomic_ref<uint32_t>(*m_cq_tail).load(std::memory_order_acquire);
+
+    while(head != tail)
+    {
+        handler(static_cast<const io_uring_cqe&>(m_cqes[head & m_cq_mask]));
+        ++head;
+        ++count;
+
+        // Handlers may queue more work, catch up with completions posted in the meantime
+        if(head == tail)
+        {
+            std::atomic_ref<uint32_t>(*m_cq_head).store(head, std::memory_order_release);
+            tail = std::atomic_ref<uint32_t>(*m_cq_tail).load(std::memory_order_acquire);
+        }
+    }
+
+    std::atomic_ref<uint32_t>(*m_cq_head).store(head, std::memory_order_release);
+    return count;
+}
+
+template<typename Handler>
+void uring::async_wait(Handler&& handler)
+{
+    m_event_desc.async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        [this, handler = std::forward<Handler>(handler)](const boost::system::error_code& ec) mutable
+        {
+            if(ec)
+                return;
+
+            // Completions are reaped regardless of how many signals there were
+            eventfd_t val;
+            ::eventfd_read(m_event_fd, &val);
+            handler();
+        }
+    );
+}
+
+}
+}
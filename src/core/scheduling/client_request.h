@@ -1,11 +1,11 @@
 #pragma once
 
 #include "utf_core.h"
+#include "buffer_pool.h"
 
 #include <boost/asio/ip/address_v4.hpp>
 
 #include <cstdint>
-#include <vector>
 
 namespace utf
 {
@@ -53,7 +53,7 @@ struct client_request
     client_request& operator=(const client_request& other) = delete;
     client_request& operator=(client_request&& other) = delete;
 
-    std::vector<char> payload;
+    aux::byte_buffer payload;
     uint64_t arr_timestamp_ms;
     uint32_t listener_id;
     uint16_t client_port;
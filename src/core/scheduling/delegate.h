@@ -0,0 +1,92 @@
+#pragma once
+
+#include <type_traits>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Single target call with the target fixed when the delegate is made: an object pointer
+// and a function generated for the exact method, so a call is one indirect call with
+// no type erasure, allocation or locking. The method itself is a template argument,
+// so it's inlined into the generated function.
+// Not thread-safe to rebind, targets are meant to be bound before traffic starts.
+// Targets aren't owned and must outlive every call.
+template<class ... Args>
+class delegate
+{
+    using stub_t = void (*)(void*, Args ...);
+
+public:
+    delegate() = default;
+
+    // Non-static method, e.g. delegate<int>::bind<&foo::bar>(&foo_obj)
+    template<auto Method, class Owner>
+    static delegate bind(Owner* optr)
+    {
+        static_assert(std::is_member_function_pointer_v<decltype(Method)>);
+        return delegate(optr, &method_stub<Owner, Method>);
+    }
+
+    // Static method or plain function
+    template<void (*Func)(Args ...)>
+    static delegate bind()
+    {
+        return delegate(nullptr, &func_stub<Func>);
+    }
+
+    // Functor, e.g. a lambda stored by the caller
+    template<class Functor>
+    static delegate bind(Functor* fptr)
+    {
+        return delegate(fptr, &functor_stub<Functor>);
+    }
+
+    void operator()(Args... args) const
+    {
+        m_stub(m_obj, args...);
+    }
+
+    // Calls the target if there is one
+    void invoke(Args... args) const
+    {
+        if(m_stub != nullptr)
+            m_stub(m_obj, args...);
+    }
+
+    explicit operator bool() const {return m_stub != nullptr;}
+
+    void reset()
+    {
+        m_obj = nullptr;
+        m_stub = nullptr;
+    }
+
+private:
+    delegate(void* obj, stub_t stub) : m_obj(obj), m_stub(stub) {}
+
+    template<class Owner, auto Method>
+    static void method_stub(void* obj, Args... args)
+    {
+        (static_cast<Owner*>(obj)->*Method)(args...);
+    }
+
+    template<void (*Func)(Args ...)>
+    static void func_stub(void*, Args... args)
+    {
+        Func(args...);
+    }
+
+    template<class Functor>
+    static void functor_stub(void* obj, Args... args)
+    {
+        (*static_cast<Functor*>(obj))(args...);
+    }
+
+    void* m_obj = nullptr;
+    stub_t m_stub = nullptr;
+};
+
+}
+}
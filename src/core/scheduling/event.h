@@ -1,18 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <thread>
 #include <type_traits>
 #include <vector>
-#include <unordered_map>
 
 namespace utf
 {
 namespace scheduling
 {
 
+// Subscribers are kept in an immutable array, which is replaced as a whole on (un)subscription
+// and published through an atomic pointer (RCU-style). invoke() counts itself in the reader count
+// of the current epoch and walks the array it loaded: a few atomic instructions, no locks,
+// so dispatching never waits for writers (invocations from many threads do share the counters' cache line).
+// Replaced arrays are retired and freed after a grace period, which unsubscribe() waits out,
+// so it returns once no invocation can reach the removed handler.
+// Subscribers owned by weak pointers are dropped from the array once their owner expires.
 template<class ... Args>
 class event
 {
@@ -21,180 +31,257 @@ class event
     using handler_raw = void (*)(Args ...);              // Static methods and plain functions
     using handler_func = std::function<void(Args ...)>;  // Functors
 
+    struct subscriber
+    {
+        // Hash of owner and handler, or a user-given id for functors
+        size_t key;
+        bool is_hashless;
+
+        // Returns false if the owner has expired
+        std::function<bool(Args ...)> call;
+
+        // Set for subscribers owned by weak pointers only
+        std::weak_ptr<const void> owner;
+        bool is_owned = false;
+    };
+
+    using subscribers_t = std::vector<subscriber>;
+
 public:
-    event() = default;
-    ~event() = default;
+    event() : m_subs(new subscribers_t()) {}
 
-    void invoke(Args... args)
+    // Nothing may be invoking the event any more
+    ~event()
     {
-        // For erasing expired owners (weak pointers)
-        std::vector<size_t> junktown;
+        delete m_subs.load(std::memory_order_relaxed);
+        for(const auto* subs : m_retired)
+            delete subs;
+    }
 
-        // Callbacks with hash
-        {
-        std::shared_lock l(m_cb_access_mx);
-        for(auto& cb : m_cb)
-        {
-            auto erase_request = [&cb, &junktown] () {junktown.push_back(cb.first);};
+    event(const event& other) = delete;
+    event& operator=(const event& other) = delete;
 
-            cb.second(erase_request, args...);
-        }
-        }
+    void invoke(Args... args)
+    {
+        // Events with no subscribers are common, don't touch the array then
+        if(m_count.load(std::memory_order_acquire) == 0)
+            return;
 
-        // Callbacks without hash
-        {
-        std::shared_lock l(m_cb_access_mx);
-        for(auto& cb : m_hashless_cb)
+        bool has_expired = false;
         {
-            cb.second(args...);
-        }
+            // The array can't be freed while it's counted here, also if a handler throws
+            read_guard guard(m_readers[m_epoch.load() & 1]);
+            const subscribers_t* subs = m_subs.load();
+
+            for(const auto& sub : *subs)
+            {
+                if(!sub.call(args...))
+                    has_expired = true;
+            }
         }
 
-        // Dispose of expired owners
-        {
-        std::shared_lock l(m_cb_access_mx);
-        for(const size_t& hash : junktown)
+        // Dispose of expired owners, unless a writer is busy (it'll be done next time then)
+        if(has_expired)
         {
-            m_cb.erase(hash);
-        }
+            std::unique_lock l(m_write_mx, std::try_to_lock);
+            if(l.owns_lock())
+                reap_expired();
         }
     }
 
     template<class Owner>
     void subscribe(std::shared_ptr<Owner> optr, handler_member<Owner> hdlr)
     {
-        auto h1 = std::hash<decltype(optr.get())>{};
-        auto h2 = std::hash<unsigned long>{};
-
-        size_t hash = h1(optr.get()) ^ h2(*reinterpret_cast<unsigned long*>(&hdlr));
-
         std::weak_ptr<Owner> weak = optr;
 
         auto wrapper =
-        [weak, hdlr](std::function<void()> del_req, Args&&... args)
+        [weak, hdlr](Args... args)
         {
-            // Dispose of this owner if it no longer exists
+            // Report this owner for disposal if it no longer exists
             auto shared = weak.lock();
             if(!shared)
-            {
-                del_req();
-                return;
-            }
+                return false;
 
             // Otherwise, call its member function
             (shared.get()->*hdlr)(args...);
+            return true;
         };
 
-        std::unique_lock l(m_cb_access_mx);
-        auto emp = m_cb.emplace(hash, wrapper);
+        add(subscriber{hash_of(optr.get(), hdlr), false, std::move(wrapper), weak, true});
     }
 
     template<class Owner>
     void unsubscribe(std::shared_ptr<Owner> optr, handler_member<Owner> hdlr)
     {
-        auto h1 = std::hash<decltype(optr.get())>{};
-        auto h2 = std::hash<unsigned long>{};
-
-        size_t hash = h1(optr.get()) ^ h2(*reinterpret_cast<unsigned long*>(&hdlr));
-
-        std::unique_lock l(m_cb_access_mx);
-        auto it = m_cb.find(hash);
-        if(it != m_cb.end())
-        {
-            m_cb.erase(it);
-        }
+        remove(hash_of(optr.get(), hdlr), false);
     }
 
     template<class Owner>
     void subscribe(Owner* optr, handler_member<Owner> hdlr)
     {
-        auto h1 = std::hash<decltype(optr)>{};
-        auto h2 = std::hash<unsigned long>{};
-
-        size_t hash = h1(optr) ^ h2(*reinterpret_cast<unsigned long*>(&hdlr));
-
         auto wrapper =
-        [optr, hdlr]([[maybe_unused]] std::function<void()> del_req, Args... args)
+        [optr, hdlr](Args... args)
         {
             // Do nothing to this object, since we don't own it
             (optr->*hdlr)(args...);
+            return true;
         };
 
-        std::unique_lock l(m_cb_access_mx);
-        auto emp = m_cb.emplace(hash, wrapper);
+        add(subscriber{hash_of(optr, hdlr), false, std::move(wrapper)});
     }
 
     template<class Owner>
     void unsubscribe(Owner* optr, handler_member<Owner> hdlr)
     {
-        auto h1 = std::hash<decltype(optr)>{};
-        auto h2 = std::hash<unsigned long>{};
-
-        size_t hash = h1(optr) ^ h2(*reinterpret_cast<unsigned long*>(&hdlr));
-
-        std::unique_lock l(m_cb_access_mx);
-        auto it = m_cb.find(hash);
-        if(it != m_cb.end())
-        {
-            m_cb.erase(it);
-        }
+        remove(hash_of(optr, hdlr), false);
     }
 
     void subscribe(handler_raw hdlr)
     {
-        auto h = std::hash<unsigned long>{};
-        size_t hash = h(*reinterpret_cast<unsigned long*>(&hdlr));
-
         auto wrapper =
-        [hdlr]([[maybe_unused]] std::function<void()> del_req, Args&&... args)
+        [hdlr](Args... args)
         {
             hdlr(args...);
+            return true;
         };
 
-        std::unique_lock l(m_cb_access_mx);
-        auto emp = m_cb.emplace(hash, wrapper);
+        add(subscriber{hash_of(hdlr), false, std::move(wrapper)});
     }
 
     void unsubscribe(handler_raw hdlr)
     {
-        auto h = std::hash<unsigned long>{};
-        size_t hash = h(*reinterpret_cast<unsigned long*>(&hdlr));
-
-        std::unique_lock l(m_cb_access_mx);
-        auto it = m_cb.find(hash);
-        if(it != m_cb.end())
-        {
-            m_cb.erase(it);
-        }
+        remove(hash_of(hdlr), false);
     }
 
     // Hashless part V V V
 
     void subscribe(size_t id, handler_func hdlr)
     {
-        std::unique_lock l(m_cb_access_mx);
-        auto emp = m_hashless_cb.emplace(id, hdlr);
+        auto wrapper =
+        [hdlr = std::move(hdlr)](Args... args)
+        {
+            hdlr(args...);
+            return true;
+        };
+
+        add(subscriber{id, true, std::move(wrapper)});
     }
 
     void unsubscribe(size_t id)
     {
-        std::unique_lock l(m_cb_access_mx);
-        auto it = m_hashless_cb.find(id);
-        if(it != m_hashless_cb.end())
+        remove(id, true);
+    }
+
+private:
+    template<class Owner>
+    static size_t hash_of(const Owner* optr, handler_member<Owner> hdlr)
+    {
+        auto h1 = std::hash<const Owner*>{};
+        auto h2 = std::hash<unsigned long>{};
+        return h1(optr) ^ h2(*reinterpret_cast<unsigned long*>(&hdlr));
+    }
+
+    static size_t hash_of(handler_raw hdlr)
+    {
+        auto h = std::hash<unsigned long>{};
+        return h(*reinterpret_cast<unsigned long*>(&hdlr));
+    }
+
+    // Counts an invocation in for as long as it walks the array
+    struct read_guard
+    {
+        explicit read_guard(std::atomic_size_t& readers) : m_readers(readers) {m_readers.fetch_add(1);}
+        ~read_guard() {m_readers.fetch_sub(1);}
+
+        read_guard(const read_guard& other) = delete;
+        read_guard& operator=(const read_guard& other) = delete;
+
+        std::atomic_size_t& m_readers;
+    };
+
+    // A subscriber with the same key is kept as it is.
+    // The previous array is only retired, so subscribing from a handler is fine.
+    void add(subscriber&& sub)
+    {
+        std::lock_guard l(m_write_mx);
+        const subscribers_t* curr = m_subs.load(std::memory_order_relaxed);
+
+        auto same = [&sub](const subscriber& s){return s.key == sub.key && s.is_hashless == sub.is_hashless;};
+        if(std::any_of(curr->begin(), curr->end(), same))
+            return;
+
+        auto* next = new subscribers_t(*curr);
+        next->push_back(std::move(sub));
+        publish(next);
+    }
+
+    // Must not be called from a handler of the same event, the grace period would never end
+    void remove(size_t key, bool is_hashless)
+    {
+        std::lock_guard l(m_write_mx);
+        const subscribers_t* prev = m_subs.load(std::memory_order_relaxed);
+
+        auto same = [key, is_hashless](const subscriber& s){return s.key == key && s.is_hashless == is_hashless;};
+        if(std::none_of(prev->begin(), prev->end(), same))
+            return;
+
+        auto* next = new subscribers_t();
+        next->reserve(prev->size() - 1);
+        std::copy_if(prev->begin(), prev->end(), std::back_inserter(*next), std::not_fn(same));
+        publish(next);
+
+        // No invocation holds a retired array after this
+        wait_for_readers();
+        for(const auto* subs : m_retired)
+            delete subs;
+        m_retired.clear();
+    }
+
+    // Writers' mutex must be held
+    void reap_expired()
+    {
+        const subscribers_t* curr = m_subs.load(std::memory_order_relaxed);
+
+        auto* next = new subscribers_t();
+        next->reserve(curr->size());
+        std::copy_if(curr->begin(), curr->end(), std::back_inserter(*next),
+            [](const subscriber& s){return !s.is_owned || !s.owner.expired();});
+        publish(next);
+    }
+
+    // Writers' mutex must be held, the replaced array is retired
+    void publish(const subscribers_t* next)
+    {
+        m_retired.push_back(m_subs.load(std::memory_order_relaxed));
+        m_count.store(next->size(), std::memory_order_release);
+        m_subs.store(next);
+    }
+
+    // Grace period, writers' mutex must be held. New invocations count themselves in the other epoch,
+    // so waiting for an epoch's count to drain ends. Two flips catch invocations that read
+    // the epoch before the previous flip and counted themselves in late.
+    void wait_for_readers()
+    {
+        for(int phase = 0; phase < 2; ++phase)
         {
-            m_hashless_cb.erase(it);
+            uint32_t epoch = m_epoch.load();
+            m_epoch.store(epoch + 1);
+            while(m_readers[epoch & 1].load() != 0)
+                std::this_thread::yield();
         }
     }
 
-private:
-    // Hashable functions are wrapped for convenience and loopback control (if possible)
-    std::unordered_map<size_t, std::function<void(std::function<void()>, Args...)>> m_cb;
+    std::atomic<const subscribers_t*> m_subs;
+    std::atomic_size_t m_count = 0;
 
-    // Functions that cannot be hashed (lambdas, etc.) are stored with a user-given id
-    std::unordered_map<size_t, handler_func> m_hashless_cb;
+    // Invocations in flight, by the parity of the epoch they started in
+    std::atomic_uint32_t m_epoch = 0;
+    std::atomic_size_t m_readers[2] = {0, 0};
 
-    std::shared_mutex m_cb_access_mx;
+    // Arrays replaced since the last grace period, and the mutex serializing writers (readers never take it)
+    std::vector<const subscribers_t*> m_retired;
+    std::mutex m_write_mx;
 };
 
 }
-}
\ No newline at end of file
+}
@@ -2,11 +2,23 @@
 
 #include "client_request.h"
 
+#include <span>
+
 namespace utf
 {
 namespace scheduling
 {
 
+// Backend selection policies
+enum class scheduler_t
+{
+    round_robin,
+    least_outstanding,
+    p2c_ewma,
+    consistent_hash,
+    weighted_round_robin
+};
+
 class forwarder
 {
 public:
@@ -14,6 +26,9 @@ public:
 
     virtual void schedule(const client_request& req) = 0;
     virtual void schedule(client_request&& req) = 0;
+
+    // Requests are moved from
+    virtual void schedule(std::span<client_request> reqs) = 0;
 };
 
 }
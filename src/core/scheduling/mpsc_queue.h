@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Bounded lock-free queue for many producers and a single consumer.
+// Every cell carries a sequence number telling whether it's free for the producer
+// of the current lap or holds a value for the consumer (D. Vyukov's bounded queue).
+// Producers contend only on one atomic counter, the consumer doesn't contend at all.
+template<typename T>
+class mpsc_queue
+{
+public:
+    explicit mpsc_queue(size_t capacity)
+    {
+        // Round capacity up to a power of two, so positions are mapped with a mask
+        size_t cap = 2;
+        while(cap < capacity)
+            cap <<= 1;
+
+        m_mask = cap - 1;
+        m_cells = std::make_unique<cell[]>(cap);
+        for(size_t i = 0; i < cap; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~mpsc_queue()
+    {
+        while(front())
+            pop();
+    }
+
+    mpsc_queue(const mpsc_queue& other) = delete;
+    mpsc_queue(mpsc_queue&& other) = delete;
+    mpsc_queue& operator=(const mpsc_queue& other) = delete;
+    mpsc_queue& operator=(mpsc_queue&& other) = delete;
+
+    // Producer side, returns false if the queue is full
+    template<typename U>
+    bool try_push(U&& value)
+    {
+        cell* c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if(diff == 0)
+            {
+                // The cell is free on this lap, try to claim it
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                // The consumer hasn't released the cell yet
+                return false;
+            }
+            else
+            {
+                // Another producer got ahead of us
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (c->storage) T(std::forward<U>(value));
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns the oldest element or nullptr if there is none
+    T* front()
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell& c = m_cells[pos & m_mask];
+        if(c.seq.load(std::memory_order_acquire) != pos + 1)
+            return nullptr;
+
+        return std::launder(reinterpret_cast<T*>(c.storage));
+    }
+
+    // Consumer side, destroys the element returned by front()
+    void pop()
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell& c = m_cells[pos & m_mask];
+        std::launder(reinterpret_cast<T*>(c.storage))->~T();
+
+        // Free the cell for the producers of the next lap
+        c.seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+    }
+
+    // Approximate, for statistics only
+    size_t size() const
+    {
+        size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    size_t capacity() const {return m_mask + 1;}
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    std::unique_ptr<cell[]> m_cells;
+    size_t m_mask;
+
+    // Positions are kept on separate cache lines
+    alignas(64) std::atomic<size_t> m_enqueue_pos = 0;
+    alignas(64) std::atomic<size_t> m_dequeue_pos = 0;
+};
+
+}
+}
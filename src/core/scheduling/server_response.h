@@ -1,9 +1,9 @@
 #pragma once
 
 #include "utf_core.h"
+#include "buffer_pool.h"
 
 #include <cstdint>
-#include <vector>
 
 namespace utf
 {
@@ -28,6 +28,13 @@ struct server_response
         }
     }
 
+    server_response(
+        uint64_t req_id,
+        uint64_t resp_ts_us,
+        aux::byte_buffer&& pl) :
+        request_id(req_id), resp_timestamp_us(resp_ts_us), payload(std::move(pl))
+    {}
+
     server_response(const server_response& other)
     {
         request_id = other.request_id;
@@ -47,7 +54,7 @@ struct server_response
 
     uint64_t request_id;
     uint64_t resp_timestamp_us;
-    std::vector<char> payload;
+    aux::byte_buffer payload;
 };
 
 }
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace utf
+{
+namespace scheduling
+{
+
+enum class wakeup_mode
+{
+    park,       // Sleep right away when there is nothing to do
+    adaptive    // Spin for a while before sleeping
+};
+
+// Lets a single consumer thread sleep until producers report queued work.
+// Producers only touch the mutex when the consumer is actually asleep.
+class work_signal
+{
+public:
+    work_signal(wakeup_mode mode = wakeup_mode::park, uint32_t spin_us = 0) :
+        m_mode(mode), m_spin_us(spin_us)
+    {}
+
+    work_signal(const work_signal& other) = delete;
+    work_signal& operator=(const work_signal& other) = delete;
+
+    // Producer side: report that work has been queued
+    void notify()
+    {
+        // Someone has already reported since the consumer's last look
+        if(m_pending.exchange(true))
+            return;
+
+        if(m_sleeping.load())
+        {
+            std::lock_guard l(m_mx);
+            m_cv.notify_one();
+        }
+    }
+
+    // Consumer side: acknowledge reported work before draining the queues
+    bool reset()
+    {
+        return m_pending.exchange(false);
+    }
+
+    // Consumer side: block until notified
+    void wait()
+    {
+        if(spin())
+            return;
+
+        std::unique_lock l(m_mx);
+        m_sleeping.store(true);
+        m_cv.wait(l, [this](){return m_pending.load();});
+        m_sleeping.store(false);
+    }
+
+    // Consumer side: block until notified or until the timeout expires
+    template<class Rep, class Period>
+    void wait_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if(spin())
+            return;
+
+        std::unique_lock l(m_mx);
+        m_sleeping.store(true);
+        m_cv.wait_for(l, timeout, [this](){return m_pending.load();});
+        m_sleeping.store(false);
+    }
+
+private:
+    // Busy-wait for a notification in adaptive mode, true if one arrived
+    bool spin()
+    {
+        if(m_pending.load())
+            return true;
+
+        if(m_mode != wakeup_mode::adaptive || m_spin_us == 0)
+            return false;
+
+        using namespace std::chrono;
+        auto deadline = steady_clock::now() + microseconds(m_spin_us);
+        for(uint32_t i = 1;; ++i)
+        {
+            if(m_pending.load(std::memory_order_relaxed))
+                return true;
+
+            // Don't query the clock on every iteration
+            if((i & 0x3f) == 0 && steady_clock::now() >= deadline)
+                return false;
+
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+    }
+
+    const wakeup_mode m_mode;
+    const uint32_t m_spin_us;
+
+    std::atomic_bool m_pending = false;
+    std::atomic_bool m_sleeping = false;
+
+    std::mutex m_mx;
+    std::condition_variable m_cv;
+};
+
+}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Smooth weighted round robin (as in nginx): every round each backend gains its weight,
+// the richest one is picked and pays the total weight. Picks of a heavy backend are
+// interleaved with the others instead of coming in bursts.
+// The sequence repeats every sum(weights) / gcd(weights) picks, so it's computed once
+// and picking is a table lookup, no matter how many backends there are.
+class wrr_schedule
+{
+public:
+    // Zero weights are treated as 1
+    explicit wrr_schedule(const std::vector<uint32_t>& weights)
+    {
+        uint64_t divisor = 0;
+        for(uint32_t w : weights)
+            divisor = std::gcd(divisor, std::max<uint64_t>(w, 1));
+
+        std::vector<int64_t> norm(weights.size());
+        int64_t total = 0;
+        for(size_t i = 0; i < weights.size(); ++i)
+        {
+            norm[i] = std::max<uint64_t>(weights[i], 1) / divisor;
+            total += norm[i];
+        }
+
+        std::vector<int64_t> current(weights.size(), 0);
+        m_table.reserve(total);
+        for(int64_t n = 0; n < total; ++n)
+        {
+            size_t best = 0;
+            for(size_t i = 0; i < norm.size(); ++i)
+            {
+                current[i] += norm[i];
+                if(current[i] > current[best])
+                    best = i;
+            }
+            current[best] -= total;
+            m_table.push_back(static_cast<uint32_t>(best));
+        }
+    }
+
+    // Index of the next backend in the sequence
+    uint32_t next()
+    {
+        uint32_t backend = m_table[m_pos];
+        if(++m_pos == m_table.size())
+            m_pos = 0;
+        return backend;
+    }
+
+    // Length of the sequence
+    size_t size() const {return m_table.size();}
+
+private:
+    std::vector<uint32_t> m_table;
+    size_t m_pos = 0;
+};
+
+}
+}
@@ -5,8 +5,15 @@
 #include <vector>
 #include <limits>
 #include <iostream>
+#include <sstream>
+#include <utility>
 
 #include "json_parser.h"
+#include "wakeup.h"
+#include "forwarder.h"
+#include "edr_logger.h"
+#include "thread_placement.h"
+#include "endpoint.h"
 
 #include <boost/asio/ip/address_v4.hpp>
 
@@ -17,24 +24,130 @@ namespace utf
 namespace aux
 {
 
+constexpr uint32_t MAX_UDP_BATCH_SIZE = 1024;
+constexpr uint32_t MAX_UDP_SHARDS = 256;
+constexpr uint32_t MAX_TCP_CONNECTIONS = 64;
+constexpr uint32_t MAX_TCP_WEIGHT = 100;
+constexpr uint32_t MAX_TCP_THREADS = 256;
+
 struct tcp_client_config
 {
     boost::asio::ip::address_v4 ipv4;
     uint16_t port;
+    uint32_t connections = 1;
+    uint32_t weight = 1;
+};
+
+// How threads of a role share io_context's
+enum class io_model
+{
+    shared,     // One io_context run by every thread
+    per_thread  // An io_context per thread, TCP connections are spread across them
+};
+
+struct runtime_config
+{
+    // 0 keeps the count used before this option: 1, plus hardware_concurrency / 4 with more than 4 CPUs
+    uint32_t tcp_threads = 0;
+    io_model tcp_io = io_model::shared;
+
+    // UDP threads are the UDP shards, the forwarder and the EDR writer have a thread each
+    thread_placement udp;
+    thread_placement tcp;
+    thread_placement forwarder;
+    thread_placement edr_writer;
 };
 
 struct config
 {
     std::vector<uint16_t> udp_ports;
+    uint32_t udp_batch_size = 1;
+    uint32_t udp_shards = 1;
     std::vector<tcp_client_config> tcp_clients;
 
     uint32_t response_timeout_ms = 2000;
     uint32_t connection_timeout_ms = 5000;
 
+    bool tcp_nodelay = false;
+    bool tcp_cork = false;
+
+    // I/O of UDP servers and TCP clients
+    endpoints::io_engine engine = endpoints::io_engine::asio;
+
+    scheduling::scheduler_t scheduler = scheduling::scheduler_t::round_robin;
+    scheduling::wakeup_mode forwarder_wakeup = scheduling::wakeup_mode::park;
+    uint32_t forwarder_spin_us = 50;
+    uint32_t queue_capacity = 65536;
+
+    // Port of the local metrics endpoint, 0 disables it
+    uint16_t metrics_port = 0;
+
     std::string log_file_path;
+    edr_format edr_log_format = edr_format::text;
+    uint64_t edr_file_records = 1048576;
+    edr_overflow_policy edr_overflow = edr_overflow_policy::drop;
+    uint32_t edr_flush_bytes = 65536;
+    uint32_t edr_flush_interval_ms = 1000;
+
+    runtime_config runtime;
+
     spdlog::level::level_enum logging_lvl;
 };
 
+std::ostream& operator<<(std::ostream& os, const thread_placement& pl)
+{
+    if(pl.cpus.empty())
+        os << "unpinned";
+    else
+    {
+        os << "CPUs";
+        for(auto cpu : pl.cpus)
+            os << " " << cpu;
+    }
+    return os;
+}
+
+// Reads "0-3,8" strings and [0, 1, 2, 3, 8] arrays, invalid entries are skipped
+std::vector<uint32_t> read_cpu_list(const boost::json::value& val)
+{
+    std::vector<uint32_t> cpus;
+    auto add = [&cpus](int64_t first, int64_t last)
+    {
+        for(int64_t cpu = first; cpu <= last && cpu <= MAX_CPU_INDEX; ++cpu)
+        {
+            if(cpu >= 0)
+                cpus.push_back(cpu);
+        }
+    };
+
+    if(val.is_array())
+    {
+        for(const auto& elem : val.as_array())
+        {
+            if(elem.is_int64())
+                add(elem.as_int64(), elem.as_int64());
+        }
+    }
+    else if(val.is_string())
+    {
+        std::istringstream items(std::string(val.as_string().begin(), val.as_string().end()));
+        std::string item;
+        while(std::getline(items, item, ','))
+        {
+            int64_t first, last;
+            char dash;
+            std::istringstream range(item);
+            if(!(range >> first))
+                continue;
+            if(!(range >> dash))
+                add(first, first);
+            else if(dash == '-' && range >> last)
+                add(first, last);
+        }
+    }
+    return cpus;
+}
+
 std::ostream& operator<<(std::ostream& os, const config& cfg)
 {
     os << "Configuration:\n";
@@ -44,16 +157,64 @@ std::ostream& operator<<(std::ostream& os, const config& cfg)
         os << elem << "\n";
     }
 
+    os << "UDP batch size: " << cfg.udp_batch_size << "\n";
+    os << "UDP shards per port: " << cfg.udp_shards << "\n";
+
     os << "TCP clients:\n";
     for(const auto& elem : cfg.tcp_clients)
     {
-        os << elem.ipv4 << ":" << elem.port << "\n";
+        os << elem.ipv4 << ":" << elem.port << " (" << elem.connections << " connections, weight " << elem.weight << ")\n";
     }
 
     os << "Response timeout (ms): " << cfg.response_timeout_ms << "\n";
     os << "Connection timeout (ms): " << cfg.connection_timeout_ms << "\n";
+    os << "TCP_NODELAY: " << (cfg.tcp_nodelay ? "on" : "off") << "\n";
+    os << "TCP_CORK: " << (cfg.tcp_cork ? "on" : "off") << "\n";
+    os << "I/O engine: " << (cfg.engine == endpoints::io_engine::io_uring ? "io_uring" : "asio") << "\n";
+
+    os << "Scheduler: ";
+    switch(cfg.scheduler)
+    {
+        case scheduling::scheduler_t::least_outstanding:
+            os << "least outstanding requests\n";
+            break;
+        case scheduling::scheduler_t::p2c_ewma:
+            os << "power of two choices, peak EWMA\n";
+            break;
+        case scheduling::scheduler_t::consistent_hash:
+            os << "consistent hash of client endpoint\n";
+            break;
+        case scheduling::scheduler_t::weighted_round_robin:
+            os << "weighted round robin\n";
+            break;
+        default:
+            os << "round robin\n";
+            break;
+    }
+
+    os << "Forwarder wakeup: ";
+    if(cfg.forwarder_wakeup == scheduling::wakeup_mode::adaptive)
+        os << "adaptive (spin " << cfg.forwarder_spin_us << " us)\n";
+    else
+        os << "park\n";
+    os << "Queue capacity: " << cfg.queue_capacity << "\n";
+    os << "Metrics port: " << (cfg.metrics_port == 0 ? "disabled" : std::to_string(cfg.metrics_port)) << "\n";
 
-    os << "ERD log: " << (cfg.log_file_path.empty() ? "not provided" : cfg.log_file_path) << std::endl;
+    os << "ERD log: " << (cfg.log_file_path.empty() ? "not provided" : cfg.log_file_path) << "\n";
+    if(cfg.edr_log_format == edr_format::binary)
+        os << "EDR format: binary (" << cfg.edr_file_records << " records per file)\n";
+    else
+        os << "EDR format: text\n";
+    os << "EDR queue overflow: " << (cfg.edr_overflow == edr_overflow_policy::block ? "block" : "drop") << "\n";
+    os << "EDR flush: every " << cfg.edr_flush_bytes << " bytes or " << cfg.edr_flush_interval_ms << " ms\n";
+
+    const auto& rt = cfg.runtime;
+    os << "UDP threads: " << cfg.udp_shards << ", " << rt.udp << "\n";
+    os << "TCP threads: " << (rt.tcp_threads == 0 ? std::string("auto") : std::to_string(rt.tcp_threads)) <<
+        (rt.tcp_io == io_model::per_thread ? " (io_context per thread), " : " (shared io_context), ") << rt.tcp << "\n";
+    os << "Forwarder thread: " << rt.forwarder << "\n";
+    os << "EDR writer thread: " << rt.edr_writer << "\n";
+    os << "NUMA-local memory: " << (rt.tcp.numa_local ? "on" : "off") << std::endl;
 
     return os;
 }
@@ -67,11 +228,27 @@ config read_config(const boost::json::value& json_cfg)
     auto json_obj = json_cfg.as_object();
 
     auto udp_p = json_obj.find("udp_ports");
+    auto udp_b = json_obj.find("udp_batch_size");
+    auto udp_s = json_obj.find("udp_shards");
     auto tcp_c = json_obj.find("tcp_clients");
     auto log_p = json_obj.find("edr_log");
+    auto edr_f = json_obj.find("edr_format");
+    auto edr_r = json_obj.find("edr_file_records");
+    auto edr_o = json_obj.find("edr_overflow");
+    auto edr_b = json_obj.find("edr_flush_bytes");
+    auto edr_i = json_obj.find("edr_flush_interval_ms");
     auto rsp_t = json_obj.find("response_timeout_ms");
     auto cnn_t = json_obj.find("connection_timeout_ms");
+    auto tcp_n = json_obj.find("tcp_nodelay");
+    auto tcp_k = json_obj.find("tcp_cork");
+    auto io_e = json_obj.find("io_engine");
     auto log_l = json_obj.find("logging_level");
+    auto sch_t = json_obj.find("scheduler");
+    auto fwd_w = json_obj.find("forwarder_wakeup");
+    auto fwd_s = json_obj.find("forwarder_spin_us");
+    auto que_c = json_obj.find("queue_capacity");
+    auto mtr_p = json_obj.find("metrics_port");
+    auto rtm = json_obj.find("runtime");
 
     // Read ports as numbers
     if(udp_p != json_obj.end() && udp_p->value().is_array())
@@ -85,7 +262,23 @@ config read_config(const boost::json::value& json_cfg)
         }
     }
 
-    // Read clients as <ipv4, port> pairs (<string, number>)
+    // Read UDP batch size as number, clamp
+    if(udp_b != json_obj.end() && udp_b->value().is_int64())
+    {
+        const auto& udp_b_val = udp_b->value().as_int64();
+        if(udp_b_val > 0)
+            cfg.udp_batch_size = udp_b_val > MAX_UDP_BATCH_SIZE ? MAX_UDP_BATCH_SIZE : udp_b_val;
+    }
+
+    // Read UDP shards count as number, clamp
+    if(udp_s != json_obj.end() && udp_s->value().is_int64())
+    {
+        const auto& udp_s_val = udp_s->value().as_int64();
+        if(udp_s_val > 0)
+            cfg.udp_shards = udp_s_val > MAX_UDP_SHARDS ? MAX_UDP_SHARDS : udp_s_val;
+    }
+
+    // Read clients as <ipv4, port> pairs (<string, number>), with optional connections count and weight
     if(tcp_c != json_obj.end() && tcp_c->value().is_array())
     {
         for(const auto& elem : tcp_c->value().as_array())
@@ -111,6 +304,24 @@ config read_config(const boost::json::value& json_cfg)
             if(ec || port_val.as_int64() <= 0)
                 continue;
             client_candidate.port = port_val.as_int64();
+
+            // Read connections count as number, clamp
+            auto conn = elem_obj.find("connections");
+            if(conn != elem_obj.end() && conn->value().is_int64())
+            {
+                const auto& conn_val = conn->value().as_int64();
+                if(conn_val > 0)
+                    client_candidate.connections = conn_val > MAX_TCP_CONNECTIONS ? MAX_TCP_CONNECTIONS : conn_val;
+            }
+
+            // Read weight as number, clamp
+            auto wght = elem_obj.find("weight");
+            if(wght != elem_obj.end() && wght->value().is_int64())
+            {
+                const auto& wght_val = wght->value().as_int64();
+                if(wght_val > 0)
+                    client_candidate.weight = wght_val > MAX_TCP_WEIGHT ? MAX_TCP_WEIGHT : wght_val;
+            }
             
             cfg.tcp_clients.emplace_back(std::move(client_candidate));
         }
@@ -123,6 +334,53 @@ config read_config(const boost::json::value& json_cfg)
         cfg.log_file_path = std::string(log_p_str.begin(), log_p_str.end());
     }
 
+    // Read EDR format as string
+    if(edr_f != json_obj.end() && edr_f->value().is_string())
+    {
+        const auto& edr_f_str = edr_f->value().as_string();
+        if(edr_f_str == "binary")
+            cfg.edr_log_format = edr_format::binary;
+        else if(edr_f_str == "text")
+            cfg.edr_log_format = edr_format::text;
+    }
+
+    // Read records per binary EDR file as number
+    if(edr_r != json_obj.end() && edr_r->value().is_int64())
+    {
+        const auto& edr_r_val = edr_r->value().as_int64();
+        if(edr_r_val > 0)
+            cfg.edr_file_records = edr_r_val;
+    }
+
+    // Read EDR queue overflow behaviour as string
+    if(edr_o != json_obj.end() && edr_o->value().is_string())
+    {
+        const auto& edr_o_str = edr_o->value().as_string();
+        if(edr_o_str == "block")
+            cfg.edr_overflow = edr_overflow_policy::block;
+        else if(edr_o_str == "drop")
+            cfg.edr_overflow = edr_overflow_policy::drop;
+    }
+
+    using edr_b_lim = std::numeric_limits<decltype(cfg.edr_flush_bytes)>;
+    using edr_i_lim = std::numeric_limits<decltype(cfg.edr_flush_interval_ms)>;
+
+    // Read EDR flush size as number, clamp
+    if(edr_b != json_obj.end() && edr_b->value().is_int64())
+    {
+        const auto& edr_b_val = edr_b->value().as_int64();
+        if(edr_b_val >= 0)
+            cfg.edr_flush_bytes = edr_b_val > edr_b_lim::max() ? edr_b_lim::max() : edr_b_val;
+    }
+
+    // Read EDR flush interval as number, clamp
+    if(edr_i != json_obj.end() && edr_i->value().is_int64())
+    {
+        const auto& edr_i_val = edr_i->value().as_int64();
+        if(edr_i_val > 0)
+            cfg.edr_flush_interval_ms = edr_i_val > edr_i_lim::max() ? edr_i_lim::max() : edr_i_val;
+    }
+
     using rsp_t_lim = std::numeric_limits<decltype(cfg.response_timeout_ms)>;
     using cnn_t_lim = std::numeric_limits<decltype(cfg.connection_timeout_ms)>;
 
@@ -142,6 +400,137 @@ config read_config(const boost::json::value& json_cfg)
             cfg.connection_timeout_ms = cnn_t_val > cnn_t_lim::max() ? cnn_t_lim::max() : cnn_t_val;
     }
 
+    // Read TCP socket options as booleans
+    if(tcp_n != json_obj.end() && tcp_n->value().is_bool())
+        cfg.tcp_nodelay = tcp_n->value().as_bool();
+    if(tcp_k != json_obj.end() && tcp_k->value().is_bool())
+        cfg.tcp_cork = tcp_k->value().as_bool();
+
+    // Read I/O engine as string
+    if(io_e != json_obj.end() && io_e->value().is_string())
+    {
+        const auto& io_e_str = io_e->value().as_string();
+        if(io_e_str == "io_uring")
+            cfg.engine = endpoints::io_engine::io_uring;
+        else if(io_e_str == "asio")
+            cfg.engine = endpoints::io_engine::asio;
+    }
+
+    // Read scheduler as string
+    if(sch_t != json_obj.end() && sch_t->value().is_string())
+    {
+        const auto& sch_t_str = sch_t->value().as_string();
+        if(sch_t_str == "least_outstanding")
+            cfg.scheduler = scheduling::scheduler_t::least_outstanding;
+        else if(sch_t_str == "p2c_ewma")
+            cfg.scheduler = scheduling::scheduler_t::p2c_ewma;
+        else if(sch_t_str == "consistent_hash")
+            cfg.scheduler = scheduling::scheduler_t::consistent_hash;
+        else if(sch_t_str == "weighted_round_robin")
+            cfg.scheduler = scheduling::scheduler_t::weighted_round_robin;
+        else if(sch_t_str == "round_robin")
+            cfg.scheduler = scheduling::scheduler_t::round_robin;
+    }
+
+    // Read forwarder wakeup mode as string
+    if(fwd_w != json_obj.end() && fwd_w->value().is_string())
+    {
+        const auto& fwd_w_str = fwd_w->value().as_string();
+        if(fwd_w_str == "adaptive")
+            cfg.forwarder_wakeup = scheduling::wakeup_mode::adaptive;
+        else if(fwd_w_str == "park")
+            cfg.forwarder_wakeup = scheduling::wakeup_mode::park;
+    }
+
+    using fwd_s_lim = std::numeric_limits<decltype(cfg.forwarder_spin_us)>;
+
+    // Read forwarder spin duration as number, clamp
+    if(fwd_s != json_obj.end() && fwd_s->value().is_int64())
+    {
+        const auto& fwd_s_val = fwd_s->value().as_int64();
+        if(fwd_s_val >= 0)
+            cfg.forwarder_spin_us = fwd_s_val > fwd_s_lim::max() ? fwd_s_lim::max() : fwd_s_val;
+    }
+
+    using que_c_lim = std::numeric_limits<decltype(cfg.queue_capacity)>;
+
+    // Read queue capacity as number, clamp
+    if(que_c != json_obj.end() && que_c->value().is_int64())
+    {
+        const auto& que_c_val = que_c->value().as_int64();
+        if(que_c_val > 0)
+            cfg.queue_capacity = que_c_val > que_c_lim::max() ? que_c_lim::max() : que_c_val;
+    }
+
+    using mtr_p_lim = std::numeric_limits<decltype(cfg.metrics_port)>;
+
+    // Read metrics port as number, out of range ports disable the endpoint
+    if(mtr_p != json_obj.end() && mtr_p->value().is_int64())
+    {
+        const auto& mtr_p_val = mtr_p->value().as_int64();
+        if(mtr_p_val > 0 && mtr_p_val <= mtr_p_lim::max())
+            cfg.metrics_port = mtr_p_val;
+    }
+
+    // Read runtime section as object, every field is optional
+    if(rtm != json_obj.end() && rtm->value().is_object())
+    {
+        const auto& rtm_obj = rtm->value().as_object();
+        auto& rt = cfg.runtime;
+
+        // Read UDP threads count as number, clamp. It's the same as udp_shards, which it overrides
+        auto udp_t = rtm_obj.find("udp_threads");
+        if(udp_t != rtm_obj.end() && udp_t->value().is_int64())
+        {
+            const auto& udp_t_val = udp_t->value().as_int64();
+            if(udp_t_val > 0)
+                cfg.udp_shards = udp_t_val > MAX_UDP_SHARDS ? MAX_UDP_SHARDS : udp_t_val;
+        }
+
+        // Read TCP threads count as number, clamp
+        auto tcp_t = rtm_obj.find("tcp_threads");
+        if(tcp_t != rtm_obj.end() && tcp_t->value().is_int64())
+        {
+            const auto& tcp_t_val = tcp_t->value().as_int64();
+            if(tcp_t_val > 0)
+                rt.tcp_threads = tcp_t_val > MAX_TCP_THREADS ? MAX_TCP_THREADS : tcp_t_val;
+        }
+
+        // Read TCP io_context model as string
+        auto tcp_i = rtm_obj.find("tcp_io");
+        if(tcp_i != rtm_obj.end() && tcp_i->value().is_string())
+        {
+            const auto& tcp_i_str = tcp_i->value().as_string();
+            if(tcp_i_str == "per_thread")
+                rt.tcp_io = io_model::per_thread;
+            else if(tcp_i_str == "shared")
+                rt.tcp_io = io_model::shared;
+        }
+
+        // Read CPU lists of every role
+        std::pair<const char*, thread_placement*> roles[] =
+        {
+            {"udp_cpus", &rt.udp},
+            {"tcp_cpus", &rt.tcp},
+            {"forwarder_cpus", &rt.forwarder},
+            {"edr_cpus", &rt.edr_writer}
+        };
+        for(auto [key, placement] : roles)
+        {
+            auto cpus = rtm_obj.find(key);
+            if(cpus != rtm_obj.end())
+                placement->cpus = read_cpu_list(cpus->value());
+        }
+
+        // Read NUMA-local allocation as boolean, it applies to every role
+        auto numa = rtm_obj.find("numa_local");
+        if(numa != rtm_obj.end() && numa->value().is_bool())
+        {
+            for(auto [key, placement] : roles)
+                placement->numa_local = numa->value().as_bool();
+        }
+    }
+
     // Read logging level as number, map to spdlog::level::level_enum
     if(log_l != json_obj.end() && log_l->value().is_int64())
     {
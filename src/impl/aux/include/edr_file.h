@@ -0,0 +1,115 @@
+#pragma once
+
+#include "edr_logger.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace utf
+{
+namespace aux
+{
+
+// Binary EDR files: a header followed by fixed-width records, both in host byte order
+constexpr char EDR_FILE_MAGIC[8] = {'U', 'T', 'F', 'E', 'D', 'R', '\0', '\0'};
+constexpr uint32_t EDR_FILE_VERSION = 1;
+
+struct edr_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+
+    // Records the file has room for, and records actually written
+    uint64_t capacity;
+    uint64_t count;
+
+    char reserved[32];
+};
+
+// Same fields as edr, addresses as numbers
+struct edr_record
+{
+    uint64_t arrival_time_ms;
+    uint64_t tcp_resp_dur_us;
+    uint32_t client_addr;
+    uint32_t server_addr;
+    uint16_t client_port;
+    uint16_t server_port;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(edr_file_header) == 64);
+static_assert(sizeof(edr_record) == 32);
+
+edr_record to_record(const edr& edr_rep);
+edr from_record(const edr_record& rec);
+
+// Appends records to memory-mapped files <base_path>.0, <base_path>.1, ...
+// Every file is preallocated for records_per_file records, the next one is started once it's full.
+// A closed file is truncated to the records it holds. If the next file can't be created
+// (e.g. the disk is full), records are dropped and creating it is retried every OPEN_RETRY_INTERVAL.
+class edr_file_writer
+{
+public:
+    edr_file_writer() = delete;
+    edr_file_writer(const std::string& base_path, uint64_t records_per_file);
+
+    edr_file_writer(const edr_file_writer& other) = delete;
+    edr_file_writer(edr_file_writer&& other) = delete;
+    edr_file_writer& operator=(const edr_file_writer& other) = delete;
+    edr_file_writer& operator=(edr_file_writer&& other) = delete;
+
+    ~edr_file_writer();
+
+    // Returns false if the record couldn't be stored (the next file couldn't be created)
+    bool append(const edr& edr_rep);
+
+    static constexpr std::chrono::seconds OPEN_RETRY_INTERVAL{1};
+
+private:
+    void open_next();
+    void try_open_next();
+    void close_current();
+
+    const std::string m_base_path;
+    const uint64_t m_capacity;
+    uint32_t m_file_idx = 0;
+
+    // When creating the next file may be tried again after a failure
+    std::chrono::steady_clock::time_point m_retry_at;
+
+    int m_fd = -1;
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    edr_file_header* m_header = nullptr;
+    edr_record* m_records = nullptr;
+};
+
+// Maps a binary EDR file for reading, throws if it's not one
+class edr_file_reader
+{
+public:
+    edr_file_reader() = delete;
+    explicit edr_file_reader(const std::string& path);
+
+    edr_file_reader(const edr_file_reader& other) = delete;
+    edr_file_reader(edr_file_reader&& other) = delete;
+    edr_file_reader& operator=(const edr_file_reader& other) = delete;
+    edr_file_reader& operator=(edr_file_reader&& other) = delete;
+
+    ~edr_file_reader();
+
+    std::span<const edr_record> records() const {return m_records;}
+
+private:
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    std::span<const edr_record> m_records;
+};
+
+}
+}
@@ -2,12 +2,20 @@
 
 #include "json_parser.h"
 #include "formatted_logger.h"
+#include "mpsc_queue.h"
+#include "wakeup.h"
 
 #include <boost/asio/ip/address.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
 
 namespace utf
 {
@@ -28,25 +36,91 @@ struct edr
     uint16_t server_port;
 };
 
+enum class edr_format
+{
+    text,   // One line per record
+    binary  // Fixed-width records in memory-mapped files, see edr_file.h
+};
+
+// What write() does when the writer thread falls behind
+enum class edr_overflow_policy
+{
+    drop,   // Discard the record and count it
+    block   // Wait until there's room
+};
+
+struct edr_logger_options
+{
+    edr_format format = edr_format::text;
+
+    // Binary files are rotated after this many records
+    uint64_t file_records = 1048576;
+
+    // Capacity of the records queue
+    size_t queue_capacity = 65536;
+    edr_overflow_policy overflow = edr_overflow_policy::drop;
+
+    // Formatted records are written out once this many bytes are buffered...
+    size_t flush_bytes = 64 * 1024;
+    // ...or once this much time has passed since the last write
+    uint32_t flush_interval_ms = 1000;
+
+    // Called on the writer thread before it starts (e.g. to pin it)
+    std::function<void()> thread_init;
+};
+
+// Longest line format_edr() produces
+constexpr size_t MAX_EDR_TEXT_SIZE = 128;
+
+// Writes the record as a text line to dest, returns the end of the line
+char* format_edr(const edr& edr_rep, char* dest);
+
+class edr_file_writer;
+
+// Records are queued by write() and formatted into a large buffer on a writer thread of its own,
+// so reporting doesn't cost a system call on the caller's thread
 class edr_logger : public utf::aux::formatted_logger<edr>
 {
 public:
     edr_logger() = delete;
-    edr_logger(const std::string& file_name);
-    edr_logger(std::ofstream&& os) noexcept;
+    edr_logger(const std::string& file_name, const edr_logger_options& opts = edr_logger_options{});
+
+    // Text format only
+    edr_logger(std::ofstream&& os, const edr_logger_options& opts = edr_logger_options{});
 
     edr_logger(const edr_logger& other) = delete;
     edr_logger(edr_logger&& other) = delete;
     edr_logger& operator=(const edr_logger& other) = delete;
     edr_logger& operator=(edr_logger&& other) = delete;
 
-    ~edr_logger() override = default;
+    // Writes out everything queued so far
+    ~edr_logger() override;
 
 private:
     void write(const edr& edr_rep) override;
 
+    void start();
+    void writer_loop();
+    void format(const edr& edr_rep);
+    void flush();
+
+    const edr_logger_options m_opts;
     std::ofstream m_dest;
+    std::unique_ptr<edr_file_writer> m_bin_dest;
+
+    // Filled by write(), drained by the writer thread only
+    scheduling::mpsc_queue<edr> m_records;
+    scheduling::work_signal m_work_sig;
+
+    // Writer thread's formatting buffer
+    std::string m_buf;
+    std::chrono::steady_clock::time_point m_last_flush;
+
+    std::atomic_uint64_t m_dropped_recs = 0;
+
+    std::future<void> m_stop_sync;
+    std::atomic_bool m_is_stopped = false;
 };
 
 }
-}
\ No newline at end of file
+}
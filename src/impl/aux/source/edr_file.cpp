@@ -0,0 +1,218 @@
+#include "edr_file.h"
+
+#include "spdlog/spdlog.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+
+namespace utf
+{
+namespace aux
+{
+
+static std::runtime_error sys_error(const std::string& what, const std::string& path)
+{
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+edr_record to_record(const edr& edr_rep)
+{
+    return edr_record
+    {
+        .arrival_time_ms = edr_rep.arrival_time_ms,
+        .tcp_resp_dur_us = edr_rep.tcp_resp_dur_us,
+        .client_addr = edr_rep.client_addr.to_uint(),
+        .server_addr = edr_rep.server_addr.to_uint(),
+        .client_port = edr_rep.client_port,
+        .server_port = edr_rep.server_port,
+        .reserved = 0
+    };
+}
+
+edr from_record(const edr_record& rec)
+{
+    return edr
+    {
+        .arrival_time_ms = rec.arrival_time_ms,
+        .tcp_resp_dur_us = rec.tcp_resp_dur_us,
+        .client_addr = ip::address_v4(rec.client_addr),
+        .server_addr = ip::address_v4(rec.server_addr),
+        .client_port = rec.client_port,
+        .server_port = rec.server_port
+    };
+}
+
+edr_file_writer::edr_file_writer(const std::string& base_path, uint64_t records_per_file) :
+    m_base_path(base_path),
+    m_capacity(records_per_file > 0 ? records_per_file : 1)
+{
+    open_next();
+}
+
+edr_file_writer::~edr_file_writer()
+{
+    close_current();
+}
+
+bool edr_file_writer::append(const edr& edr_rep)
+{
+    if(m_header != nullptr && m_header->count == m_capacity)
+    {
+        close_current();
+        try_open_next();
+    }
+    else if(m_header == nullptr && std::chrono::steady_clock::now() >= m_retry_at)
+    {
+        try_open_next();
+    }
+
+    if(m_header == nullptr)
+        return false;
+
+    m_records[m_header->count] = to_record(edr_rep);
+    ++m_header->count;
+    return true;
+}
+
+void edr_file_writer::try_open_next()
+{
+    try
+    {
+        open_next();
+    }
+    catch(const std::exception& e)
+    {
+        spdlog::error("EDR file rotation failed, retrying in {0} s: {1}", OPEN_RETRY_INTERVAL.count(), e.what());
+        m_retry_at = std::chrono::steady_clock::now() + OPEN_RETRY_INTERVAL;
+    }
+}
+
+// The file index moves on only once the file is set up, so a retry reuses it
+void edr_file_writer::open_next()
+{
+    std::string path = m_base_path + "." + std::to_string(m_file_idx);
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(m_fd < 0)
+        throw sys_error("Unable to open", path);
+
+    // Reserve the blocks up front, so running out of disk space can't fault a write into the mapping
+    m_map_size = sizeof(edr_file_header) + m_capacity * sizeof(edr_record);
+    if(int err = ::posix_fallocate(m_fd, 0, m_map_size); err != 0)
+    {
+        errno = err;
+        auto e = sys_error("Unable to preallocate", path);
+        ::close(m_fd);
+        m_fd = -1;
+        throw e;
+    }
+
+    m_map = ::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if(m_map == MAP_FAILED)
+    {
+        auto e = sys_error("Unable to map", path);
+        m_map = nullptr;
+        ::close(m_fd);
+        m_fd = -1;
+        throw e;
+    }
+
+    m_header = static_cast<edr_file_header*>(m_map);
+    std::memset(m_header, 0, sizeof(edr_file_header));
+    std::memcpy(m_header->magic, EDR_FILE_MAGIC, sizeof(EDR_FILE_MAGIC));
+    m_header->version = EDR_FILE_VERSION;
+    m_header->record_size = sizeof(edr_record);
+    m_header->capacity = m_capacity;
+    m_header->count = 0;
+
+    m_records = reinterpret_cast<edr_record*>(static_cast<char*>(m_map) + sizeof(edr_file_header));
+    ++m_file_idx;
+
+    spdlog::debug("Writing EDRs to {0}", path);
+}
+
+void edr_file_writer::close_current()
+{
+    if(m_header == nullptr)
+        return;
+
+    // Drop the unused preallocated tail
+    size_t used_size = sizeof(edr_file_header) + m_header->count * sizeof(edr_record);
+
+    ::munmap(m_map, m_map_size);
+    if(::ftruncate(m_fd, used_size) != 0)
+        spdlog::warn("Unable to truncate EDR file: {0}", std::strerror(errno));
+    ::close(m_fd);
+
+    m_fd = -1;
+    m_map = nullptr;
+    m_map_size = 0;
+    m_header = nullptr;
+    m_records = nullptr;
+}
+
+edr_file_reader::edr_file_reader(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        throw sys_error("Unable to open", path);
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0)
+    {
+        auto e = sys_error("Unable to stat", path);
+        ::close(fd);
+        throw e;
+    }
+
+    m_map_size = st.st_size;
+    if(m_map_size < sizeof(edr_file_header))
+    {
+        ::close(fd);
+        throw std::runtime_error("Not an EDR file: " + path);
+    }
+
+    m_map = ::mmap(nullptr, m_map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(m_map == MAP_FAILED)
+    {
+        m_map = nullptr;
+        throw sys_error("Unable to map", path);
+    }
+
+    // Records are read sequentially
+    ::madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+
+    const auto* header = static_cast<const edr_file_header*>(m_map);
+    bool is_valid =
+        std::memcmp(header->magic, EDR_FILE_MAGIC, sizeof(EDR_FILE_MAGIC)) == 0 &&
+        header->version == EDR_FILE_VERSION &&
+        header->record_size == sizeof(edr_record) &&
+        header->count <= (m_map_size - sizeof(edr_file_header)) / sizeof(edr_record);
+    if(!is_valid)
+    {
+        ::munmap(m_map, m_map_size);
+        m_map = nullptr;
+        throw std::runtime_error("Not an EDR file or unsupported version: " + path);
+    }
+
+    m_records = std::span<const edr_record>(
+        reinterpret_cast<const edr_record*>(static_cast<const char*>(m_map) + sizeof(edr_file_header)),
+        header->count
+    );
+}
+
+edr_file_reader::~edr_file_reader()
+{
+    if(m_map != nullptr)
+        ::munmap(m_map, m_map_size);
+}
+
+}
+}
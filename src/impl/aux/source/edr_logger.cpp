@@ -1,46 +1,202 @@
 #include "edr_logger.h"
+#include "edr_file.h"
 #include "utf_core.h"
 
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <charconv>
 #include <exception>
-#include <iomanip>
+#include <string_view>
+#include <thread>
 
 namespace utf
 {
 namespace aux
 {
 
-edr_logger::edr_logger(const std::string& file_name)
+edr_logger::edr_logger(const std::string& file_name, const edr_logger_options& opts) :
+    m_opts(opts),
+    m_records(opts.queue_capacity)
 {
-    m_dest = std::ofstream(file_name);
-    if(!m_dest.is_open())
+    if(m_opts.format == edr_format::binary)
+    {
+        m_bin_dest = std::make_unique<edr_file_writer>(file_name, m_opts.file_records);
+    }
+    else
     {
-        throw std::runtime_error("Unable to open " + file_name);
+        m_dest = std::ofstream(file_name);
+        if(!m_dest.is_open())
+        {
+            throw std::runtime_error("Unable to open " + file_name);
+        }
     }
+    start();
 }
 
-edr_logger::edr_logger(std::ofstream&& os) noexcept
+edr_logger::edr_logger(std::ofstream&& os, const edr_logger_options& opts) :
+    m_opts(opts),
+    m_dest(std::move(os)),
+    m_records(opts.queue_capacity)
 {
-    m_dest = std::move(os);
+    if(m_opts.format != edr_format::text)
+    {
+        throw std::runtime_error("EDR stream supports text format only");
+    }
+    start();
+}
+
+edr_logger::~edr_logger()
+{
+    m_is_stopped.store(true);
+    m_work_sig.notify();
+    m_stop_sync.get();
+
+    if(m_dropped_recs.load() > 0)
+    {
+        spdlog::warn("{0} EDRs were dropped due to full queue", m_dropped_recs.load());
+    }
+}
+
+void edr_logger::start()
+{
+    if(!m_bin_dest)
+        m_buf.reserve(m_opts.flush_bytes + MAX_EDR_TEXT_SIZE);
+    m_last_flush = std::chrono::steady_clock::now();
+
+    m_stop_sync = std::async(
+        std::launch::async,
+        &edr_logger::writer_loop,
+        this
+    );
 }
 
 void edr_logger::write(const edr& edr_rep)
 {
-    m_dest <<
-            edr_rep.arrival_time_ms << " " <<
-            edr_rep.client_addr << ":" << edr_rep.client_port << " " <<
-            edr_rep.server_addr << ":" << edr_rep.server_port << " ";
-        
+    while(!m_records.try_push(edr_rep))
+    {
+        if(m_opts.overflow == edr_overflow_policy::drop || m_is_stopped.load())
+        {
+            if(m_dropped_recs.fetch_add(1) == 0)
+            {
+                spdlog::warn("EDR queue is full, dropping records");
+            }
+            return;
+        }
+
+        m_work_sig.notify();
+        std::this_thread::yield();
+    }
+    m_work_sig.notify();
+}
+
+void edr_logger::writer_loop()
+{
+    using namespace std::chrono;
+    const auto flush_interval = milliseconds(m_opts.flush_interval_ms);
+
+    if(m_opts.thread_init)
+        m_opts.thread_init();
+
+    for(;;)
+    {
+        // Anything queued after this point will trigger another iteration
+        m_work_sig.reset();
+
+        // Records queued before the stop are still written
+        bool is_stopped = m_is_stopped.load();
+
+        while(auto* rec = m_records.front())
+        {
+            // Binary records go straight to the mapped file, there is nothing to flush
+            if(m_bin_dest)
+            {
+                if(!m_bin_dest->append(*rec))
+                    m_dropped_recs.fetch_add(1);
+            }
+            else
+            {
+                format(*rec);
+                if(m_buf.size() >= m_opts.flush_bytes)
+                    flush();
+            }
+            m_records.pop();
+        }
+
+        if(is_stopped)
+            break;
+
+        if(!m_buf.empty() && steady_clock::now() - m_last_flush >= flush_interval)
+            flush();
+
+        m_work_sig.wait_for(flush_interval);
+    }
+    flush();
+}
+
+// Appends "<octets>:<port>"
+static char* format_endpoint(char* it, char* end, const ip::address_v4& addr, uint16_t port)
+{
+    auto bytes = addr.to_bytes();
+    for(size_t i = 0; i < bytes.size(); ++i)
+    {
+        if(i > 0)
+            *it++ = '.';
+        it = std::to_chars(it, end, bytes[i]).ptr;
+    }
+    *it++ = ':';
+    return std::to_chars(it, end, port).ptr;
+}
+
+char* format_edr(const edr& edr_rep, char* dest)
+{
+    char* end = dest + MAX_EDR_TEXT_SIZE;
+
+    char* it = std::to_chars(dest, end, edr_rep.arrival_time_ms).ptr;
+    *it++ = ' ';
+    it = format_endpoint(it, end, edr_rep.client_addr, edr_rep.client_port);
+    *it++ = ' ';
+    it = format_endpoint(it, end, edr_rep.server_addr, edr_rep.server_port);
+    *it++ = ' ';
+
     if(edr_rep.tcp_resp_dur_us == TIMESTAMP_TIMEOUT)
     {
-        m_dest << "timed_out";
+        constexpr std::string_view timed_out = "timed_out";
+        it = std::copy(timed_out.begin(), timed_out.end(), it);
     }
     else
     {
-        m_dest << edr_rep.tcp_resp_dur_us / 1000 << "." <<
-            std::setw(3) << std::setfill('0') << edr_rep.tcp_resp_dur_us % 1000 << "_ms";
+        // Milliseconds with three fractional digits
+        it = std::to_chars(it, end, edr_rep.tcp_resp_dur_us / 1000).ptr;
+        uint32_t frac = edr_rep.tcp_resp_dur_us % 1000;
+        *it++ = '.';
+        *it++ = '0' + frac / 100;
+        *it++ = '0' + frac / 10 % 10;
+        *it++ = '0' + frac % 10;
+        *it++ = '_';
+        *it++ = 'm';
+        *it++ = 's';
+    }
+    *it++ = '\n';
+    return it;
+}
+
+void edr_logger::format(const edr& edr_rep)
+{
+    char rec[MAX_EDR_TEXT_SIZE];
+    m_buf.append(rec, format_edr(edr_rep, rec));
+}
+
+void edr_logger::flush()
+{
+    if(!m_buf.empty() && !m_bin_dest)
+    {
+        m_dest.write(m_buf.data(), m_buf.size());
+        m_dest.flush();
+        m_buf.clear();
     }
-    m_dest << std::endl;
+    m_last_flush = std::chrono::steady_clock::now();
 }
 
 }
-}
\ No newline at end of file
+}
@@ -1,4 +1,6 @@
 #pragma once
 
 #include "tcp_client.h"
+#include "tcp_client_pool.h"
 #include "udp_server.h"
+#include "metrics_server.h"
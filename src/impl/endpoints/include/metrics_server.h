@@ -0,0 +1,44 @@
+#pragma once
+
+#include "metrics.h"
+
+#include <boost/asio.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace utf
+{
+namespace endpoints
+{
+
+// Serves the registry's metrics over HTTP on a local port: every request,
+// whatever its path, gets the whole registry in Prometheus text format.
+class metrics_server
+{
+public:
+    metrics_server(
+        boost::asio::io_context& ioc,
+        uint16_t port,
+        aux::metrics::registry& reg = aux::metrics::registry::global()
+    );
+    ~metrics_server();
+
+    metrics_server(const metrics_server& other) = delete;
+    metrics_server& operator=(const metrics_server& other) = delete;
+
+    void stop();
+
+private:
+    class session;
+
+    void start_accept();
+    void accept_token(const boost::system::error_code& ec, boost::asio::ip::tcp::socket sock);
+
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::steady_timer m_accept_backoff;
+    aux::metrics::registry& m_registry;
+};
+
+}
+}
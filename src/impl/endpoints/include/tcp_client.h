@@ -4,15 +4,22 @@
 #include "event.h"
 #include "server_response.h"
 #include "endpoint.h"
+#include "frame.h"
+#include "timing_wheel.h"
+#include "metrics.h"
+#include "uring.h"
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/atomic.hpp>
 #include <boost/bind/bind.hpp>
 
+#include <array>
 #include <chrono>
+#include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <vector>
 
 #include <iostream>
 
@@ -23,6 +30,19 @@ namespace utf
 namespace endpoints
 {
 
+struct tcp_socket_options
+{
+    // Disable Nagle's algorithm
+    bool no_delay = false;
+
+    // Hold partial segments back while a batch of frames is being written
+    bool cork = false;
+
+    // With io_uring, responses are received by a multishot recv into provided buffers
+    // and frames are written by sendmsg, connecting and timeouts stay with asio
+    io_engine engine = io_engine::asio;
+};
+
 template<>
 class net_endpoint<proto_t::tcp, endpoint_t::client>
 {
@@ -33,12 +53,15 @@ public:
         boost::asio::io_context& ioc,
         const boost::asio::ip::tcp::endpoint& targ,
         uint64_t conn_timeo_ms,
-        uint64_t resp_timeo_ms
+        uint64_t resp_timeo_ms,
+        const tcp_socket_options& sock_opts = tcp_socket_options{}
     );
     ~net_endpoint();
 
+    // Thread-safe, frames are queued and written on the connection's strand
     template<utf::byte_ptr BP>
     int send(uint64_t req_id, const BP begin, const BP end);
+    int send(uint64_t req_id, aux::byte_buffer&& payload);
 
     void stop();
     bool is_connected() const {return m_is_conn.load() && m_sock.is_open();}
@@ -49,42 +72,109 @@ public:
     scheduling::event<const scheduling::server_response&> resp_giveaway_evt;
 
 private:
+    // Header is kept apart from the payload, both go out in a single gathered write
+    struct outgoing_frame
+    {
+        std::array<char, FRAME_HEADER_SIZE> header;
+        aux::byte_buffer payload;
+    };
+
     void start_connect();
 
     void conn_timeo_token(const boost::system::error_code& ec);
-    void resp_timeo_token(
-        const boost::system::error_code& ec,
-        req_id_t request_id
-    );
+    void resp_timeo_token(const boost::system::error_code& ec);
+
+    void start_resp_timeo_tick();
+    uint64_t current_tick() const;
 
     void conn_token(const boost::system::error_code& ec);
-    void send_token(
+    void write_token(
         const boost::system::error_code& ec,
-        size_t bytes_count,
-        std::shared_ptr<std::vector<char>> buf
+        size_t bytes_count
     );
     void recv_token(
         const boost::system::error_code& ec,
         size_t bytes_count
     );
 
-    void giveaway_response(uint32_t status, req_id_t req_id, std::vector<char>&& payload);
+    bool consume_received();
+
+    void start_uring();
+    void uring_token();
+    void uring_receive();
+    bool uring_recv_completion(const io_uring_cqe& cqe, bool is_current);
+    void uring_write();
+    void uring_send();
+    void uring_write_completion(const io_uring_cqe& cqe, bool is_current);
+    uint64_t uring_user_data(uint64_t op) const;
+
+    void start_receive();
+    void start_write();
+    void reconnect();
+    void set_cork(bool is_corked);
+    void handle_response(req_id_t req_id, const char* begin, const char* end);
+
+    // Listeners may block until the forwarder drains its responses, and the forwarder sends
+    // meanwhile, so no lock send() takes (m_req_mux, m_out_mx) may be held when calling this
+    void giveaway_response(uint32_t status, req_id_t req_id, const char* begin, const char* end);
+
+    // Every handler of this connection runs on its strand
+    boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
 
     boost::asio::deadline_timer m_timeo;
     boost::asio::ip::tcp::socket m_sock;
     boost::asio::ip::tcp::endpoint m_targ;
-
-    std::vector<char> m_recv_buf;
+    tcp_socket_options m_sock_opts;
+
+    // Frames queued by senders, swapped with the (empty) write queue by the strand
+    std::mutex m_out_mx;
+    std::vector<outgoing_frame> m_out_queue;
+    bool m_is_writing = false;
+
+    // Frames being written, touched on the strand only
+    std::vector<outgoing_frame> m_write_queue;
+    std::vector<boost::asio::const_buffer> m_write_bufs;
+
+    frame_buffer m_recv_buf;
+
+    // io_uring engine, null when the socket is driven by asio.
+    // Requests carry the generation of their connection, which is bumped whenever it's abandoned,
+    // and frames of a write in flight are kept until it completes, even if the connection is lost.
+    // The ring is released before the buffers it receives into.
+    std::unique_ptr<uring_buffer_ring> m_uring_bufs;
+    std::unique_ptr<uring> m_uring;
+    uint64_t m_conn_gen = 0;
+    bool m_uring_writing = false;
+    std::vector<iovec> m_write_iovs;
+    size_t m_write_iov_pos = 0;
+    size_t m_write_bytes = 0;
+    msghdr m_write_hdr;
 
     boost::atomic_bool m_is_conn = false;
     boost::atomic_bool m_stopped = false;
 
-    std::mutex m_req_mux;
-    std::unordered_map<req_id_t, boost::asio::deadline_timer> m_req_mem;
-
     uint64_t m_conn_timeo_ms;
     uint64_t m_resp_timeo_ms;
 
+    // Response timeouts are tracked by a timing wheel, driven by a single periodic timer
+    boost::asio::steady_timer m_resp_timeo;
+    std::chrono::steady_clock::time_point m_wheel_epoch;
+    std::chrono::milliseconds m_wheel_tick;
+    uint64_t m_resp_timeo_ticks;
+
+    // Pending request IDs, mapped to their expiry ticks
+    std::mutex m_req_mux;
+    std::unordered_map<
+        req_id_t, uint64_t,
+        std::hash<req_id_t>, std::equal_to<req_id_t>,
+        aux::pool_allocator<std::pair<const req_id_t, uint64_t>>
+    > m_req_mem;
+    aux::timing_wheel<req_id_t> m_req_wheel;
+    std::vector<req_id_t> m_expired;
+
+    // Shared by every connection to the same TCP server
+    aux::metrics::counter& m_reconnects;
+
     static constexpr int32_t STATUS_OK = 0;
     static constexpr int32_t STATUS_TIMEOUT = 1;
 };
@@ -94,36 +184,14 @@ using tcp_client = net_endpoint<proto_t::tcp, endpoint_t::client>;
 template<utf::byte_ptr BP>
 int tcp_client::send(uint64_t req_id, const BP begin, const BP end)
 {
-    if(!m_is_conn.load() || end <= begin)
+    if(end <= begin)
         return -1;
-    
-    {
-        // Reject requests with existing ID
-        std::lock_guard l(m_req_mux);
-        if(m_req_mem.contains(req_id))
-            return -1;
-        
-        // Set timeout and memorize the request ID
-        auto emp = m_req_mem.emplace(req_id, boost::asio::deadline_timer(m_sock.get_executor()));
-        emp.first->second.expires_from_now(boost::posix_time::milliseconds(m_resp_timeo_ms));
-        emp.first->second.async_wait(boost::bind(&tcp_client::resp_timeo_token, this, _1, req_id));
-    }
-
-
-    auto req_id_bytes = reinterpret_cast<const char*>(&req_id);
-
-    auto send_buf = std::make_shared<std::vector<char>>();
-    send_buf->reserve(end - begin + sizeof(req_id));
-    send_buf->insert(send_buf->end(), req_id_bytes, req_id_bytes + sizeof(req_id));
-    send_buf->insert(send_buf->end(), begin, end);
-    m_sock.async_send(
-        boost::asio::buffer(*send_buf, send_buf->size()),
-        boost::bind(&tcp_client::send_token, this, _1, _2, send_buf)
-    );
 
-    return 0;
+    aux::byte_buffer payload;
+    payload.reserve(end - begin);
+    payload.insert(payload.end(), begin, end);
+    return send(req_id, std::move(payload));
 }
 
 }
 }
-
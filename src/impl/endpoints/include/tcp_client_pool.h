@@ -0,0 +1,78 @@
+#pragma once
+
+#include "tcp_client.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace utf
+{
+namespace endpoints
+{
+
+// Several connections to the same TCP server, used as a single backend.
+// Requests are spread across connected members round-robin,
+// the pool counts as connected while any of its members is.
+class tcp_client_pool
+{
+public:
+    tcp_client_pool(
+        boost::asio::io_context& ioc,
+        const boost::asio::ip::tcp::endpoint& targ,
+        uint32_t connections,
+        uint64_t conn_timeo_ms,
+        uint64_t resp_timeo_ms,
+        const tcp_socket_options& sock_opts = tcp_socket_options{}
+    );
+
+    // Connection i is served by iocs[i % iocs.size()], so a pool may span several threads' contexts
+    tcp_client_pool(
+        const std::vector<boost::asio::io_context*>& iocs,
+        const boost::asio::ip::tcp::endpoint& targ,
+        uint32_t connections,
+        uint64_t conn_timeo_ms,
+        uint64_t resp_timeo_ms,
+        const tcp_socket_options& sock_opts = tcp_socket_options{}
+    );
+    ~tcp_client_pool();
+
+    tcp_client_pool(const tcp_client_pool& other) = delete;
+    tcp_client_pool& operator=(const tcp_client_pool& other) = delete;
+
+    template<utf::byte_ptr BP>
+    int send(uint64_t req_id, const BP begin, const BP end);
+    int send(uint64_t req_id, aux::byte_buffer&& payload);
+
+    void stop();
+    bool is_connected() const;
+
+    boost::asio::ip::address_v4 get_address() const {return m_targ.address().to_v4();}
+    uint16_t get_port() const {return m_targ.port();}
+    size_t size() const {return m_conns.size();}
+
+    // Responses of every member connection
+    scheduling::event<const scheduling::server_response&> resp_giveaway_evt;
+
+private:
+    void relay_response(const scheduling::server_response& response);
+
+    boost::asio::ip::tcp::endpoint m_targ;
+    std::vector<std::unique_ptr<tcp_client>> m_conns;
+    std::atomic_size_t m_next_conn = 0;
+};
+
+template<utf::byte_ptr BP>
+int tcp_client_pool::send(uint64_t req_id, const BP begin, const BP end)
+{
+    if(end <= begin)
+        return -1;
+
+    aux::byte_buffer payload;
+    payload.reserve(end - begin);
+    payload.insert(payload.end(), begin, end);
+    return send(req_id, std::move(payload));
+}
+
+}
+}
@@ -1,15 +1,23 @@
 #pragma once
 
 #include "event.h"
+#include "delegate.h"
 #include "utf_core.h"
 #include "endpoint.h"
 #include "client_request.h"
+#include "metrics.h"
+#include "uring.h"
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/atomic.hpp>
 #include <boost/bind/bind.hpp>
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <memory>
+#include <span>
 #include <unordered_map>
 #include <mutex>
 
@@ -26,50 +34,139 @@ template<>
 class net_endpoint<proto_t::udp, endpoint_t::server>
 {
 public:
-    net_endpoint(boost::asio::io_context& ioc, uint16_t port, uint32_t id);
+    // With batch_size > 1, datagrams are received in batches with recvmmsg
+    // and reported through incoming_batch_evt instead of incoming_req_evt.
+    // Outgoing datagrams are always queued and sent with sendmmsg, batch_size at a time.
+    // Shards bind with SO_REUSEPORT, so several of them may listen on the same port.
+    // With io_uring engine, datagrams are received by a multishot recvmsg into provided buffers
+    // and sent by sendmsg requests, a whole flush in a single submission.
+    net_endpoint(
+        boost::asio::io_context& ioc,
+        uint16_t port,
+        uint32_t id,
+        uint32_t batch_size = 1,
+        bool is_shard = false,
+        io_engine engine = io_engine::asio
+    );
     ~net_endpoint();
 
+    // Thread-safe, datagram is sent on the next io_context turn
     template<utf::byte_ptr BP>
     int send(const boost::asio::ip::udp::endpoint& targ, const BP begin, const BP end);
 
     void stop();
 
+    // Handlers bound once at startup, called before the events' subscribers
+    utf::scheduling::delegate<const utf::scheduling::client_request&> incoming_req_dlg;
+    utf::scheduling::delegate<std::span<utf::scheduling::client_request>> incoming_batch_dlg;
+
     utf::scheduling::event<const utf::scheduling::client_request&> incoming_req_evt;
+    utf::scheduling::event<std::span<utf::scheduling::client_request>> incoming_batch_evt;
 private:
-    void send_token(
-        const boost::system::error_code& ec,
-        size_t bytes_count,
-        ip::udp::endpoint receiver,
-        std::shared_ptr<std::vector<char>> buf
-    );
+    struct outgoing_datagram
+    {
+        boost::asio::ip::udp::endpoint receiver;
+        size_t offset;
+        size_t size;
+    };
+
+    void flush_token();
+    void transmit();
+    void send_ready_token(const boost::system::error_code& ec);
+
     void recv_token(
         const boost::system::error_code& ec,
         size_t bytes_count
     );
+    void batch_recv_token(const boost::system::error_code& ec);
+
+    void start_receive();
+
+    void start_uring();
+    void uring_token();
+    void uring_receive();
+    bool uring_recv_completion(const io_uring_cqe& cqe, uint64_t curr_time_us);
+    void uring_transmit();
+    void deliver_batch();
 
     std::vector<char> m_recv_buf;
+
+    // Batched receive state, reused between batches
+    uint32_t m_batch_size;
+    std::vector<mmsghdr> m_batch_hdrs;
+    std::vector<iovec> m_batch_iovs;
+    std::vector<sockaddr_in> m_batch_addrs;
+    std::vector<utf::scheduling::client_request> m_batch;
+
+    // Outgoing datagrams are queued by senders, payloads are stored back to back.
+    // Flushing swaps the queue with its own (empty) copy, so both keep their capacity.
+    std::mutex m_out_mx;
+    std::vector<char> m_out_data;
+    std::vector<outgoing_datagram> m_out_queue;
+    bool m_flush_posted = false;
+    bool m_is_flushing = false;
+    uint64_t m_out_dropped = 0;
+
+    std::vector<char> m_flush_data;
+    std::vector<outgoing_datagram> m_flush_queue;
+    size_t m_flush_pos = 0;
+    std::vector<mmsghdr> m_flush_hdrs;
+    std::vector<iovec> m_flush_iovs;
+
     boost::asio::ip::udp::socket m_sock;
     boost::asio::ip::udp::endpoint m_remote_ep;
 
+    // io_uring engine, null when the socket is driven by asio.
+    // The ring is released before the buffers it receives into, which stops the kernel from using them.
+    std::unique_ptr<uring_buffer_ring> m_uring_bufs;
+    std::unique_ptr<uring> m_uring;
+    msghdr m_uring_recv_hdr;
+    std::vector<msghdr> m_uring_send_hdrs;
+    size_t m_uring_sends = 0;
+
     boost::atomic_bool m_is_stopped = false;
 
     uint32_t m_id;
+
+    // Shared by every shard of the port
+    aux::metrics::counter& m_dgrams_in;
+    aux::metrics::counter& m_dgrams_out;
+    aux::metrics::counter& m_dgrams_dropped;
 };
 
 using udp_server = net_endpoint<proto_t::udp, endpoint_t::server>;
 
+// Queued bytes above which outgoing datagrams are dropped
+constexpr size_t MAX_UDP_OUT_QUEUE_BYTES = 16 * 1024 * 1024;
+
 template<utf::byte_ptr BP>
 int udp_server::send(const boost::asio::ip::udp::endpoint& targ, const BP begin, const BP end)
 {
-    auto send_buf = std::make_shared<std::vector<char>>();
-    send_buf->reserve(end - begin);
-    send_buf->insert(send_buf->begin(), begin, end);
-    m_sock.async_send_to(
-        boost::asio::buffer(*send_buf, send_buf->size()),
-        targ,
-        boost::bind(&udp_server::send_token, this, placeholders::error, placeholders::bytes_transferred, targ, send_buf)
-    );
-
+    if(end < begin)
+        return -1;
+
+    bool post_flush;
+    {
+        std::lock_guard l(m_out_mx);
+        if(m_out_data.size() + (end - begin) > MAX_UDP_OUT_QUEUE_BYTES)
+        {
+            ++m_out_dropped;
+            m_dgrams_dropped.add();
+            return -1;
+        }
+
+        m_out_queue.push_back(outgoing_datagram{targ, m_out_data.size(), static_cast<size_t>(end - begin)});
+        m_out_data.insert(m_out_data.end(), begin, end);
+
+        // One flush per io_context turn is enough
+        post_flush = !m_flush_posted;
+        m_flush_posted = true;
+    }
+
+    if(post_flush)
+    {
+        boost::asio::post(m_sock.get_executor(), boost::bind(&udp_server::flush_token, this));
+    }
     return 0;
 }
 
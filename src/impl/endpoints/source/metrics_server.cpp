@@ -0,0 +1,150 @@
+#include "metrics_server.h"
+
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <string>
+
+namespace utf
+{
+namespace endpoints
+{
+
+// Requests are only read to their end, anything longer is cut off
+static constexpr size_t MAX_REQUEST_SIZE = 8192;
+
+// Scrapers that don't finish in time (or never send a request) are disconnected
+static constexpr auto SESSION_TIMEOUT = std::chrono::seconds(5);
+
+// Accept errors are mostly out of descriptors, retrying at once would only spin
+static constexpr auto ACCEPT_BACKOFF = std::chrono::milliseconds(100);
+
+// Reads one request, writes the metrics back and closes the connection.
+// The socket is on a strand of its own, which the deadline timer shares.
+class metrics_server::session : public std::enable_shared_from_this<session>
+{
+public:
+    session(boost::asio::ip::tcp::socket&& sock, aux::metrics::registry& reg) :
+        m_sock(std::move(sock)), m_deadline(m_sock.get_executor()), m_buf(MAX_REQUEST_SIZE), m_registry(reg)
+    {}
+
+    void start()
+    {
+        auto self = shared_from_this();
+        m_deadline.expires_after(SESSION_TIMEOUT);
+        m_deadline.async_wait(
+            [self](const boost::system::error_code& ec)
+            {
+                // Closing the socket aborts the pending read or write
+                if(!ec)
+                    self->close();
+            }
+        );
+
+        boost::asio::async_read_until(m_sock, m_buf, "\r\n\r\n",
+            [self](const boost::system::error_code& ec, size_t)
+            {
+                if(ec && ec != boost::asio::error::not_found)
+                    return;
+                self->respond();
+            }
+        );
+    }
+
+private:
+    void respond()
+    {
+        std::string body = m_registry.render();
+        m_response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n"
+            "\r\n" + body;
+
+        auto self = shared_from_this();
+        boost::asio::async_write(m_sock, boost::asio::buffer(m_response),
+            [self](const boost::system::error_code& ec, size_t)
+            {
+                self->m_deadline.cancel();
+                self->close();
+            }
+        );
+    }
+
+    void close()
+    {
+        boost::system::error_code ignored;
+        m_sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        m_sock.close(ignored);
+    }
+
+    boost::asio::ip::tcp::socket m_sock;
+    boost::asio::steady_timer m_deadline;
+    boost::asio::streambuf m_buf;
+    std::string m_response;
+    aux::metrics::registry& m_registry;
+};
+
+metrics_server::metrics_server(
+    boost::asio::io_context& ioc,
+    uint16_t port,
+    aux::metrics::registry& reg
+) :
+    m_acceptor(ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
+    m_accept_backoff(ioc),
+    m_registry(reg)
+{
+    spdlog::info("Serving metrics on 127.0.0.1:{0}", port);
+    start_accept();
+}
+
+metrics_server::~metrics_server()
+{
+    stop();
+}
+
+void metrics_server::stop()
+{
+    boost::system::error_code ignored;
+    m_acceptor.close(ignored);
+    m_accept_backoff.cancel();
+}
+
+void metrics_server::start_accept()
+{
+    // TCP threads may share the io_context, a session's handlers must not run concurrently
+    m_acceptor.async_accept(boost::asio::make_strand(m_acceptor.get_executor()),
+        [this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket sock)
+        {
+            accept_token(ec, std::move(sock));
+        }
+    );
+}
+
+void metrics_server::accept_token(const boost::system::error_code& ec, boost::asio::ip::tcp::socket sock)
+{
+    if(ec)
+    {
+        if(ec != boost::asio::error::operation_aborted)
+        {
+            spdlog::error("Metrics accept error: {0}", ec.message());
+            m_accept_backoff.expires_after(ACCEPT_BACKOFF);
+            m_accept_backoff.async_wait(
+                [this](const boost::system::error_code& timer_ec)
+                {
+                    // Stopped meanwhile
+                    if(!timer_ec && m_acceptor.is_open())
+                        start_accept();
+                }
+            );
+        }
+        return;
+    }
+
+    std::make_shared<session>(std::move(sock), m_registry)->start();
+    start_accept();
+}
+
+}
+}
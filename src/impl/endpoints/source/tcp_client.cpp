@@ -2,28 +2,84 @@
 
 #include "spdlog/spdlog.h"
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+
 #include <iostream>
 #include <string>
-#include <tuple>
 
 namespace utf
 {
 namespace endpoints
 {
 
+// Response timeouts are checked this many times per timeout period (at most)
+static constexpr uint64_t RESP_TIMEO_RESOLUTION = 64;
+
+// io_uring engine: submission queue depth and receive buffers of a connection
+static constexpr uint32_t URING_ENTRIES = 32;
+static constexpr uint16_t URING_RECV_BUFFERS = 16;
+static constexpr size_t URING_RECV_BUF_SIZE = 8192;
+
+// Requests are told apart by the low byte of user data, the rest is connection generation
+static constexpr uint64_t URING_RECV = 1;
+static constexpr uint64_t URING_SEND = 2;
+static constexpr uint64_t URING_OP_MASK = 0xff;
+static constexpr int URING_GEN_SHIFT = 8;
+
 tcp_client::net_endpoint(
     boost::asio::io_context& ioc,
     const boost::asio::ip::tcp::endpoint& targ,
     uint64_t conn_timeo_ms,
-    uint64_t resp_timeo_ms
+    uint64_t resp_timeo_ms,
+    const tcp_socket_options& sock_opts
 ) :
-    m_sock(ioc),
-    m_timeo(ioc),
+    m_strand(boost::asio::make_strand(ioc)),
+    m_timeo(m_strand),
+    m_sock(m_strand),
     m_targ(targ),
+    m_sock_opts(sock_opts),
     m_conn_timeo_ms(conn_timeo_ms),
-    m_resp_timeo_ms(resp_timeo_ms)
+    m_resp_timeo_ms(resp_timeo_ms),
+    m_resp_timeo(m_strand),
+    m_wheel_epoch(std::chrono::steady_clock::now()),
+    m_wheel_tick(std::max<uint64_t>(resp_timeo_ms / RESP_TIMEO_RESOLUTION, 1)),
+    m_resp_timeo_ticks((resp_timeo_ms + m_wheel_tick.count() - 1) / m_wheel_tick.count()),
+    m_req_wheel(m_resp_timeo_ticks + 2),
+    m_reconnects(aux::metrics::registry::global().make_counter(
+        "utf_tcp_reconnects_total", "Connections to TCP servers lost or timed out and retried",
+        {{"backend", targ.address().to_string() + ":" + std::to_string(targ.port())}}))
 {
-    start_connect();
+    if(m_sock_opts.engine == io_engine::io_uring)
+    {
+        try
+        {
+            start_uring();
+        }
+        catch(const std::exception& e)
+        {
+            spdlog::warn("({0}:{1}) io_uring is unavailable, falling back to asio: {2}",
+                m_targ.address().to_string(), m_targ.port(), e.what()
+            );
+            m_uring.reset();
+            m_uring_bufs.reset();
+        }
+    }
+    count_engine_endpoint(m_uring ? io_engine::io_uring : io_engine::asio);
+
+    // Nothing may run before construction is over
+    boost::asio::dispatch(m_strand, [this]()
+    {
+        if(m_uring)
+            m_uring->async_wait(boost::bind(&tcp_client::uring_token, this));
+
+        start_connect();
+        start_resp_timeo_tick();
+    });
 }
 
 tcp_client::~net_endpoint()
@@ -58,13 +114,171 @@ void tcp_client::conn_token(const boost::system::error_code& ec)
         );
         m_timeo.expires_at(boost::posix_time::pos_infin);
         m_timeo.async_wait([](const boost::system::error_code& ec){});
+
+        boost::system::error_code opt_ec;
+        m_sock.set_option(boost::asio::ip::tcp::no_delay(m_sock_opts.no_delay), opt_ec);
+        if(opt_ec)
+        {
+            spdlog::warn("({0}:{1}) Unable to set TCP_NODELAY: {2}",
+                m_targ.address().to_string(), m_targ.port(), opt_ec.message()
+            );
+        }
+
+        // Requests of the ring wait for the socket instead of failing with EAGAIN
+        if(m_uring)
+        {
+            m_sock.native_non_blocking(false, opt_ec);
+            if(opt_ec)
+            {
+                spdlog::warn("({0}:{1}) Unable to make the socket blocking: {2}",
+                    m_targ.address().to_string(), m_targ.port(), opt_ec.message()
+                );
+            }
+        }
+
         m_is_conn.store(true);
 
-        m_recv_buf.resize(4096);
+        // Leftovers of the previous connection are meaningless
+        m_recv_buf.reset();
+        start_receive();
+    }
+}
+
+void tcp_client::start_receive()
+{
+    if(m_uring)
+    {
+        uring_receive();
+        m_uring->submit();
+        return;
+    }
+
+    m_sock.async_receive(
+        m_recv_buf.prepare(),
+        boost::bind(&tcp_client::recv_token, this, _1, _2)
+    );
+}
+
+void tcp_client::reconnect()
+{
+    m_reconnects.add();
+    m_is_conn.store(false);
+
+    // Closing the socket doesn't abort requests of the ring, shutting it down completes them
+    ++m_conn_gen;
+    if(m_uring && m_sock.is_open())
+        ::shutdown(m_sock.native_handle(), SHUT_RDWR);
+
+    if(m_sock.is_open())
+        m_sock.close();
+
+    // Queued frames were meant for the lost connection, they will time out.
+    // Frames of a write in progress are released by its (aborted) handler
+    {
+        std::lock_guard l(m_out_mx);
+        m_out_queue.clear();
+        m_is_writing = false;
+    }
+
+    start_connect();
+}
+
+int tcp_client::send(uint64_t req_id, aux::byte_buffer&& payload)
+{
+    if(!m_is_conn.load() || payload.empty() || payload.size() > MAX_FRAME_PAYLOAD_SIZE)
+        return -1;
+
+    {
+        // Reject requests with existing ID
+        std::lock_guard l(m_req_mux);
+        if(m_req_mem.contains(req_id))
+            return -1;
+
+        // Set timeout and memorize the request ID
+        uint64_t expiry_tick = current_tick() + m_resp_timeo_ticks;
+        m_req_mem.emplace(req_id, expiry_tick);
+        m_req_wheel.add(req_id, expiry_tick);
+    }
+
+    bool start_writing;
+    {
+        std::lock_guard l(m_out_mx);
+
+        auto& frame = m_out_queue.emplace_back();
+        write_frame_header(frame.header.data(), frame_header{static_cast<uint32_t>(payload.size()), req_id});
+        frame.payload = std::move(payload);
+
+        // A write in progress picks the frame up when it's done
+        start_writing = !m_is_writing;
+        m_is_writing = true;
+    }
+
+    if(start_writing)
+    {
+        boost::asio::post(m_strand, boost::bind(&tcp_client::start_write, this));
+    }
+    return 0;
+}
+
+void tcp_client::start_write()
+{
+    // A write of the lost connection is still in flight, it calls back once done
+    if(m_stopped.load() || m_uring_writing)
+        return;
 
-        m_sock.async_receive(
-            boost::asio::buffer(m_recv_buf, m_recv_buf.size()),
-            boost::bind(&tcp_client::recv_token, this, _1, _2)
+    {
+        std::lock_guard l(m_out_mx);
+        if(!m_is_conn.load())
+        {
+            // Connection was lost after the frames had been queued
+            m_out_queue.clear();
+            m_is_writing = false;
+            return;
+        }
+
+        if(m_out_queue.empty())
+        {
+            m_is_writing = false;
+            set_cork(false);
+            return;
+        }
+        std::swap(m_out_queue, m_write_queue);
+    }
+
+    // Gather every queued frame into a single write
+    m_write_bufs.clear();
+    for(const auto& frame : m_write_queue)
+    {
+        m_write_bufs.push_back(boost::asio::buffer(frame.header));
+        m_write_bufs.push_back(boost::asio::buffer(frame.payload));
+    }
+
+    set_cork(true);
+
+    if(m_uring)
+    {
+        uring_write();
+        return;
+    }
+
+    // The whole batch has to be written, otherwise the stream gets desynchronized
+    boost::asio::async_write(
+        m_sock,
+        m_write_bufs,
+        boost::bind(&tcp_client::write_token, this, _1, _2)
+    );
+}
+
+void tcp_client::set_cork(bool is_corked)
+{
+    if(!m_sock_opts.cork || !m_sock.is_open())
+        return;
+
+    int val = is_corked ? 1 : 0;
+    if(::setsockopt(m_sock.native_handle(), IPPROTO_TCP, TCP_CORK, &val, sizeof(val)) != 0)
+    {
+        spdlog::debug("({0}:{1}) Unable to set TCP_CORK",
+            m_targ.address().to_string(), m_targ.port()
         );
     }
 }
@@ -86,51 +300,57 @@ void tcp_client::conn_timeo_token(const boost::system::error_code& ec)
     );
 
     // Try reconnecting
+    m_reconnects.add();
     m_sock.close();
     start_connect();
 }
 
-void tcp_client::resp_timeo_token(
-    const boost::system::error_code& ec,
-    req_id_t request_id
-)
+uint64_t tcp_client::current_tick() const
 {
-    if(m_stopped.load())
-        return;
+    return (std::chrono::steady_clock::now() - m_wheel_epoch) / m_wheel_tick;
+}
 
-    if(ec)
-    {
-        spdlog::debug("Cancelled waiting for a timeout (request #{0:x}): {1}",
-            request_id, ec.message()
-        );
+void tcp_client::start_resp_timeo_tick()
+{
+    m_resp_timeo.expires_after(m_wheel_tick);
+    m_resp_timeo.async_wait(boost::bind(&tcp_client::resp_timeo_token, this, _1));
+}
+
+void tcp_client::resp_timeo_token(const boost::system::error_code& ec)
+{
+    if(ec || m_stopped.load())
         return;
-    }
 
-    std::lock_guard l(m_req_mux);
-    auto it = m_req_mem.find(request_id);
-    if(it == m_req_mem.end())
     {
-        spdlog::debug("Request #{0:x} does not exists", request_id);
-        return;
+        std::lock_guard l(m_req_mux);
+        m_req_wheel.advance(current_tick(),
+            [this](req_id_t request_id, uint64_t expiry_tick)
+            {
+                // Requests that got their responses are no longer remembered
+                auto it = m_req_mem.find(request_id);
+                if(it == m_req_mem.end() || it->second != expiry_tick)
+                    return;
+
+                m_req_mem.erase(it);
+                m_expired.push_back(request_id);
+            }
+        );
     }
 
-    if(it->second.expires_at() > boost::asio::deadline_timer::traits_type::now())
+    // Timeouts have expired, notify listeners (outside the lock, listeners may block)
+    for(req_id_t request_id : m_expired)
     {
-        spdlog::debug("Still waiting for a response (request #{0:x})", request_id);
-        it->second.async_wait(boost::bind(&tcp_client::resp_timeo_token, this, _1, request_id));
-        return;
+        spdlog::debug("Request #{0:x} has timed out", request_id);
+        giveaway_response(STATUS_TIMEOUT, request_id, nullptr, nullptr);
     }
+    m_expired.clear();
 
-    // Timeout has expired, notify listeners
-    giveaway_response(STATUS_TIMEOUT, request_id, std::vector<char>());
-
-    m_req_mem.erase(it);
+    start_resp_timeo_tick();
 }
 
-void tcp_client::send_token(
+void tcp_client::write_token(
     const boost::system::error_code& ec,
-    size_t bytes_count,
-    std::shared_ptr<std::vector<char>> buf
+    size_t bytes_count
 )
 {
     if(m_stopped.load())
@@ -138,21 +358,28 @@ void tcp_client::send_token(
 
     if(ec)
     {
-        spdlog::error("({0}:{1}) Send failed",
-            m_targ.address().to_string(), m_targ.port()
+        m_write_queue.clear();
+
+        // Socket has been closed on purpose, whoever did it takes care of reconnecting
+        if(ec == boost::asio::error::operation_aborted)
+            return;
+
+        spdlog::error("({0}:{1}) Send failed: {2}",
+            m_targ.address().to_string(), m_targ.port(), ec.message()
         );
 
         // Try reconnecting
-        m_is_conn.store(false);
-        if(m_sock.is_open())
-            m_sock.close();
-        start_connect();
+        reconnect();
         return;
     }
 
-    spdlog::debug("({0}:{1}) Sent {2} bytes",
-        m_targ.address().to_string(), m_targ.port(), bytes_count
+    spdlog::debug("({0}:{1}) Sent {2} frames ({3} bytes)",
+        m_targ.address().to_string(), m_targ.port(), m_write_queue.size(), bytes_count
     );
+
+    // Payloads go back to the pool, the queue keeps its capacity
+    m_write_queue.clear();
+    start_write();
 }
 
 void tcp_client::recv_token(
@@ -165,59 +392,77 @@ void tcp_client::recv_token(
 
     if(ec)
     {
+        // Socket has been closed on purpose, whoever did it takes care of reconnecting
+        if(ec == boost::asio::error::operation_aborted)
+            return;
+
         spdlog::error("({0}:{1}) Receive error: {2}",
             m_targ.address().to_string(), m_targ.port(), ec.message()
         );
 
         // Try reconnecting
-        m_is_conn.store(false);
-        if(m_sock.is_open())
-            m_sock.close();
-        start_connect();
+        reconnect();
         return;
     }
-    
-    if(bytes_count < sizeof(req_id_t))
-    {
-        spdlog::error("({0}:{1}) Received response is shorter than size of request ID ({2})",
-            m_targ.address().to_string(), m_targ.port(), sizeof(req_id_t)
-        );
-    }
-    else
-    {
-        const req_id_t* req_id = reinterpret_cast<const req_id_t*>(m_recv_buf.data());
 
-        auto [payload_begin, payload_end] = std::make_tuple(
-            (m_recv_buf.begin() + sizeof(req_id_t)),
-            (m_recv_buf.begin() + bytes_count)
-        );
-
-        spdlog::trace("({0}:{1}) Received a response on request#{2:x}",
-            m_targ.address().to_string(), m_targ.port(), *req_id
-        );
+    // A single read may contain several responses, as well as parts of them
+    m_recv_buf.commit(bytes_count);
+    if(!consume_received())
+        return;
 
-        // Received before timeout expiration, notify listeners
-        giveaway_response(STATUS_OK, *req_id, std::vector<char>(payload_begin, payload_end));
+    start_receive();
+}
 
-        std::lock_guard l(m_req_mux);
-        auto it = m_req_mem.find(*req_id);
-        if(it != m_req_mem.end())
+// Hands every complete response over, reconnects and returns false if the stream is broken
+bool tcp_client::consume_received()
+{
+    bool is_valid = m_recv_buf.consume(
+        [this](const frame_header& hdr, const char* begin, const char* end)
         {
-            spdlog::debug("Deleting request #{0:x}", *req_id);
-            m_req_mem.erase(it);
+            handle_response(hdr.request_id, begin, end);
         }
+    );
+
+    if(!is_valid)
+    {
+        spdlog::error("({0}:{1}) Received a malformed frame (payload exceeds {2} bytes)",
+            m_targ.address().to_string(), m_targ.port(), MAX_FRAME_PAYLOAD_SIZE
+        );
+
+        // The stream can't be resynchronized, start over
+        reconnect();
+        return false;
     }
+    return true;
+}
 
-    m_sock.async_receive(
-        boost::asio::buffer(m_recv_buf, m_recv_buf.size()),
-        boost::bind(&tcp_client::recv_token, this, _1, _2)
+void tcp_client::handle_response(req_id_t req_id, const char* begin, const char* end)
+{
+    spdlog::trace("({0}:{1}) Received a response on request#{2:x}",
+        m_targ.address().to_string(), m_targ.port(), req_id
     );
+
+    // Received before timeout expiration, notify listeners
+    giveaway_response(STATUS_OK, req_id, begin, end);
+
+    std::lock_guard l(m_req_mux);
+    auto it = m_req_mem.find(req_id);
+    if(it != m_req_mem.end())
+    {
+        spdlog::debug("Deleting request #{0:x}", req_id);
+        m_req_mem.erase(it);
+    }
 }
 
-void tcp_client::giveaway_response(uint32_t status, req_id_t req_id, std::vector<char>&& payload)
+void tcp_client::giveaway_response(uint32_t status, req_id_t req_id, const char* begin, const char* end)
 {
+    // Response payload is prefixed with status, build it in one go
+    aux::byte_buffer payload;
+    payload.reserve(sizeof(status) + (end - begin));
+
     const auto* status_bytes = reinterpret_cast<const char*>(&status);
-    payload.insert(payload.begin(), status_bytes, status_bytes + sizeof(status));
+    payload.insert(payload.end(), status_bytes, status_bytes + sizeof(status));
+    payload.insert(payload.end(), begin, end);
 
     // Write timestamp depending on status
     uint64_t curr_time_us;
@@ -238,7 +483,7 @@ void tcp_client::giveaway_response(uint32_t status, req_id_t req_id, std::vector
         scheduling::server_response(
             req_id,
             curr_time_us,
-            payload.begin(), payload.end()
+            std::move(payload)
         )
     );
 }
@@ -249,12 +494,228 @@ void tcp_client::stop()
     m_is_conn.store(false);
 
     m_timeo.cancel();
+    m_resp_timeo.cancel();
+
+    // Requests still in flight are cancelled when the ring is released
+    if(m_uring)
+    {
+        m_uring->cancel();
+        if(m_sock.is_open())
+            ::shutdown(m_sock.native_handle(), SHUT_RDWR);
+    }
     m_sock.close();
 
     std::lock_guard l(m_req_mux);
-    for(auto& elem : m_req_mem)
-        elem.second.cancel();
     m_req_mem.clear();
+    m_req_wheel.clear();
+}
+
+void tcp_client::start_uring()
+{
+    if(!uring::is_supported())
+        throw std::runtime_error("the kernel has no multishot receive");
+
+    m_uring = std::make_unique<uring>(m_strand, URING_ENTRIES);
+    m_uring_bufs = std::make_unique<uring_buffer_ring>(*m_uring, 0, URING_RECV_BUFFERS, URING_RECV_BUF_SIZE);
+}
+
+uint64_t tcp_client::uring_user_data(uint64_t op) const
+{
+    return (m_conn_gen << URING_GEN_SHIFT) | op;
+}
+
+void tcp_client::uring_token()
+{
+    if(m_stopped.load())
+        return;
+
+    bool is_receiving = true;
+    m_uring->reap(
+        [this, &is_receiving](const io_uring_cqe& cqe)
+        {
+            // Buffers given back to the kernel
+            if(cqe.user_data == uring_buffer_ring::PROVIDE_USER_DATA)
+                return;
+
+            bool is_current = (cqe.user_data >> URING_GEN_SHIFT) == m_conn_gen;
+            switch(cqe.user_data & URING_OP_MASK)
+            {
+                case URING_RECV:
+                    if(!uring_recv_completion(cqe, is_current))
+                        is_receiving = false;
+                    break;
+                case URING_SEND:
+                    uring_write_completion(cqe, is_current);
+                    break;
+                default:
+                    break;
+            }
+        }
+    );
+
+    if(!is_receiving && m_is_conn.load())
+        uring_receive();
+
+    // Recycled buffers and whatever the completions have queued go in a single system call
+    int res = m_uring->submit();
+    if(res < 0)
+    {
+        spdlog::error("({0}:{1}) io_uring submission failed: {2}",
+            m_targ.address().to_string(), m_targ.port(), std::strerror(-res)
+        );
+    }
+
+    m_uring->async_wait(boost::bind(&tcp_client::uring_token, this));
+}
+
+void tcp_client::uring_receive()
+{
+    // A single request keeps receiving until it runs out of buffers
+    auto* sqe = m_uring->get_sqe();
+    if(!sqe)
+    {
+        spdlog::error("({0}:{1}) Can't queue receive, submission queue is full",
+            m_targ.address().to_string(), m_targ.port()
+        );
+        reconnect();
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = m_sock.native_handle();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_uring_bufs->group_id();
+    sqe->user_data = uring_user_data(URING_RECV);
+}
+
+// Returns false if the multishot receive is over and has to be renewed
+bool tcp_client::uring_recv_completion(const io_uring_cqe& cqe, bool is_current)
+{
+    bool has_buf = cqe.flags & IORING_CQE_F_BUFFER;
+    uint16_t buf_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+    // Data of a lost connection is dropped, its buffer is reused all the same
+    if(!is_current || cqe.res <= 0)
+    {
+        if(has_buf)
+            m_uring_bufs->recycle(buf_id);
+        if(!is_current)
+            return true;
+
+        // Out of buffers, the receive is renewed once they are recycled
+        if(cqe.res == -ENOBUFS)
+            return false;
+
+        // The rest is handled the way asio reports it
+        recv_token(
+            cqe.res == 0 ?
+                boost::system::error_code(boost::asio::error::eof) :
+                boost::system::error_code(-cqe.res, boost::system::system_category()),
+            0
+        );
+        return true;
+    }
+
+    if(has_buf)
+    {
+        // Responses are parsed in the receive buffer, which keeps partial frames between reads
+        const char* data = m_uring_bufs->buffer(buf_id);
+        size_t left = cqe.res;
+        bool is_valid = true;
+        while(left > 0 && is_valid)
+        {
+            auto space = m_recv_buf.prepare();
+            size_t count = std::min(space.size(), left);
+            std::memcpy(space.data(), data, count);
+            m_recv_buf.commit(count);
+            data += count;
+            left -= count;
+
+            is_valid = consume_received();
+        }
+        m_uring_bufs->recycle(buf_id);
+
+        // Reconnecting, a new receive comes with the new connection
+        if(!is_valid)
+            return true;
+    }
+
+    return cqe.flags & IORING_CQE_F_MORE;
+}
+
+void tcp_client::uring_write()
+{
+    m_write_iovs.clear();
+    for(const auto& buf : m_write_bufs)
+        m_write_iovs.push_back(iovec{const_cast<void*>(buf.data()), buf.size()});
+    m_write_iov_pos = 0;
+    m_write_bytes = 0;
+
+    uring_send();
+}
+
+void tcp_client::uring_send()
+{
+    auto* sqe = m_uring->get_sqe();
+    if(!sqe)
+    {
+        write_token(boost::asio::error::no_buffer_space, m_write_bytes);
+        return;
+    }
+
+    std::memset(&m_write_hdr, 0, sizeof(m_write_hdr));
+    m_write_hdr.msg_iov = m_write_iovs.data() + m_write_iov_pos;
+    m_write_hdr.msg_iovlen = std::min<size_t>(m_write_iovs.size() - m_write_iov_pos, IOV_MAX);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = m_sock.native_handle();
+    sqe->addr = reinterpret_cast<uint64_t>(&m_write_hdr);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = uring_user_data(URING_SEND);
+
+    m_uring_writing = true;
+    m_uring->submit();
+}
+
+void tcp_client::uring_write_completion(const io_uring_cqe& cqe, bool is_current)
+{
+    m_uring_writing = false;
+
+    if(!is_current)
+    {
+        // Frames of the lost connection are released, those queued since then may go now
+        m_write_queue.clear();
+        start_write();
+        return;
+    }
+
+    if(cqe.res < 0)
+    {
+        write_token(boost::system::error_code(-cqe.res, boost::system::system_category()), m_write_bytes);
+        return;
+    }
+
+    // The whole batch has to be written, carry on from where a short write stopped
+    m_write_bytes += cqe.res;
+    size_t left = cqe.res;
+    while(m_write_iov_pos < m_write_iovs.size() && left >= m_write_iovs[m_write_iov_pos].iov_len)
+    {
+        left -= m_write_iovs[m_write_iov_pos].iov_len;
+        ++m_write_iov_pos;
+    }
+
+    if(m_write_iov_pos < m_write_iovs.size())
+    {
+        auto& iov = m_write_iovs[m_write_iov_pos];
+        iov.iov_base = static_cast<char*>(iov.iov_base) + left;
+        iov.iov_len -= left;
+        uring_send();
+        return;
+    }
+
+    write_token(boost::system::error_code(), m_write_bytes);
 }
 
 }
@@ -0,0 +1,97 @@
+#include "tcp_client_pool.h"
+
+#include "spdlog/spdlog.h"
+
+#include <stdexcept>
+
+namespace utf
+{
+namespace endpoints
+{
+
+tcp_client_pool::tcp_client_pool(
+    boost::asio::io_context& ioc,
+    const boost::asio::ip::tcp::endpoint& targ,
+    uint32_t connections,
+    uint64_t conn_timeo_ms,
+    uint64_t resp_timeo_ms,
+    const tcp_socket_options& sock_opts
+) :
+    tcp_client_pool(std::vector<boost::asio::io_context*>{&ioc}, targ, connections, conn_timeo_ms, resp_timeo_ms, sock_opts)
+{}
+
+tcp_client_pool::tcp_client_pool(
+    const std::vector<boost::asio::io_context*>& iocs,
+    const boost::asio::ip::tcp::endpoint& targ,
+    uint32_t connections,
+    uint64_t conn_timeo_ms,
+    uint64_t resp_timeo_ms,
+    const tcp_socket_options& sock_opts
+) :
+    m_targ(targ)
+{
+    if(connections == 0)
+        throw std::runtime_error("tcp_client_pool: Zero connections requested");
+    if(iocs.empty())
+        throw std::runtime_error("tcp_client_pool: No io_context given");
+
+    m_conns.reserve(connections);
+    for(uint32_t i = 0; i < connections; ++i)
+    {
+        auto& ioc = *iocs[i % iocs.size()];
+        m_conns.push_back(std::make_unique<tcp_client>(ioc, targ, conn_timeo_ms, resp_timeo_ms, sock_opts));
+        m_conns.back()->resp_giveaway_evt.subscribe(this, &tcp_client_pool::relay_response);
+    }
+}
+
+tcp_client_pool::~tcp_client_pool()
+{
+    stop();
+    for(const auto& conn : m_conns)
+    {
+        conn->resp_giveaway_evt.unsubscribe(this, &tcp_client_pool::relay_response);
+    }
+}
+
+int tcp_client_pool::send(uint64_t req_id, aux::byte_buffer&& payload)
+{
+    // Start from the next member, skip disconnected ones
+    size_t start = m_next_conn.fetch_add(1, std::memory_order_relaxed);
+    for(size_t i = 0; i < m_conns.size(); ++i)
+    {
+        auto& conn = m_conns[(start + i) % m_conns.size()];
+        if(conn->is_connected())
+            return conn->send(req_id, std::move(payload));
+    }
+
+    spdlog::debug("({0}:{1}) No connection is up, request #{2:x} isn't sent",
+        m_targ.address().to_string(), m_targ.port(), req_id
+    );
+    return -1;
+}
+
+void tcp_client_pool::stop()
+{
+    for(const auto& conn : m_conns)
+    {
+        conn->stop();
+    }
+}
+
+bool tcp_client_pool::is_connected() const
+{
+    for(const auto& conn : m_conns)
+    {
+        if(conn->is_connected())
+            return true;
+    }
+    return false;
+}
+
+void tcp_client_pool::relay_response(const scheduling::server_response& response)
+{
+    resp_giveaway_evt.invoke(response);
+}
+
+}
+}
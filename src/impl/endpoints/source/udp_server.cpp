@@ -4,19 +4,97 @@
 
 #include <chrono>
 
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
 namespace utf
 {
 namespace endpoints
 {
 
-udp_server::net_endpoint(boost::asio::io_context& ioc, uint16_t port, uint32_t id) :
-    m_sock(ioc, ip::udp::endpoint(ip::udp::v4(), port)), m_id(id)
+static constexpr size_t RECV_BUF_SIZE = 4096;
+
+// io_uring engine: submission queue depth, receive buffers and the cap on sends in flight,
+// which keeps their completions from overflowing the completion queue (4 times the depth)
+static constexpr uint32_t URING_ENTRIES = 256;
+static constexpr uint16_t URING_RECV_BUFFERS = 512;
+static constexpr size_t URING_MAX_SENDS = 256;
+
+// Requests are told apart by user data
+static constexpr uint64_t URING_RECV = 1;
+static constexpr uint64_t URING_SEND = 2;
+static constexpr uint64_t URING_CANCEL = 3;
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+udp_server::net_endpoint(
+    boost::asio::io_context& ioc,
+    uint16_t port,
+    uint32_t id,
+    uint32_t batch_size,
+    bool is_shard,
+    io_engine engine
+) :
+    m_batch_size(batch_size > 0 ? batch_size : 1),
+    m_sock(ioc), m_id(id),
+    m_dgrams_in(aux::metrics::registry::global().make_counter(
+        "utf_udp_datagrams_received_total", "Datagrams received from UDP clients", {{"port", std::to_string(port)}})),
+    m_dgrams_out(aux::metrics::registry::global().make_counter(
+        "utf_udp_datagrams_sent_total", "Datagrams sent back to UDP clients", {{"port", std::to_string(port)}})),
+    m_dgrams_dropped(aux::metrics::registry::global().make_counter(
+        "utf_udp_datagrams_dropped_total", "Outgoing datagrams dropped due to full queue or send errors", {{"port", std::to_string(port)}}))
 {
-    m_recv_buf.resize(4096);
-    m_sock.async_receive_from(
-        buffer(m_recv_buf), m_remote_ep,
-        boost::bind(&udp_server::recv_token, this, placeholders::error, placeholders::bytes_transferred)
-    );
+    m_sock.open(ip::udp::v4());
+
+    // Shards of the same port share it, the kernel spreads flows among them
+    if(is_shard)
+        m_sock.set_option(reuse_port(true));
+
+    m_sock.bind(ip::udp::endpoint(ip::udp::v4(), port));
+
+    if(engine == io_engine::io_uring)
+    {
+        try
+        {
+            start_uring();
+            count_engine_endpoint(io_engine::io_uring);
+            return;
+        }
+        catch(const std::exception& e)
+        {
+            spdlog::warn("(port {0}) io_uring is unavailable, falling back to asio: {1}", port, e.what());
+            m_uring.reset();
+            m_uring_bufs.reset();
+        }
+    }
+
+    m_recv_buf.resize(RECV_BUF_SIZE * m_batch_size);
+
+    m_flush_hdrs.resize(m_batch_size);
+    m_flush_iovs.resize(m_batch_size);
+
+    if(m_batch_size > 1)
+    {
+        // Every message header points to its own chunk of the receive buffer
+        m_batch_hdrs.resize(m_batch_size);
+        m_batch_iovs.resize(m_batch_size);
+        m_batch_addrs.resize(m_batch_size);
+        m_batch.reserve(m_batch_size);
+
+        for(uint32_t i = 0; i < m_batch_size; ++i)
+        {
+            m_batch_iovs[i].iov_base = m_recv_buf.data() + i * RECV_BUF_SIZE;
+            m_batch_iovs[i].iov_len = RECV_BUF_SIZE;
+        }
+    }
+
+    // Both recvmmsg and sendmmsg are used on the socket directly
+    m_sock.non_blocking(true);
+
+    count_engine_endpoint(io_engine::asio);
+    start_receive();
 }
 
 udp_server::~net_endpoint()
@@ -26,31 +104,170 @@ udp_server::~net_endpoint()
 
 void udp_server::stop()
 {
+    m_is_stopped.store(true);
+
+    // The multishot receive is cancelled right away, whatever else is in flight goes with the ring
+    if(m_uring)
+    {
+        if(auto* sqe = m_uring->get_sqe())
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_RECV;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = URING_CANCEL;
+            m_uring->submit();
+        }
+        m_uring->cancel();
+    }
     m_sock.close();
+
+    std::lock_guard l(m_out_mx);
+    if(m_out_dropped > 0)
+    {
+        spdlog::warn("{0} outgoing datagrams were dropped due to full queue", m_out_dropped);
+        m_out_dropped = 0;
+    }
 }
 
-void udp_server::send_token(
-    const boost::system::error_code& ec,
-    size_t bytes_count,
-    ip::udp::endpoint receiver,
-    std::shared_ptr<std::vector<char>> buf
-)
+void udp_server::flush_token()
+{
+    {
+        std::lock_guard l(m_out_mx);
+        m_flush_posted = false;
+
+        // An ongoing flush picks queued datagrams up by itself
+        if(m_is_flushing || m_out_queue.empty())
+            return;
+
+        m_is_flushing = true;
+        std::swap(m_out_queue, m_flush_queue);
+        std::swap(m_out_data, m_flush_data);
+    }
+
+    if(m_uring)
+    {
+        uring_transmit();
+        m_uring->submit();
+        return;
+    }
+
+    transmit();
+}
+
+void udp_server::transmit()
+{
+    for(;;)
+    {
+        while(m_flush_pos < m_flush_queue.size())
+        {
+            size_t count = std::min<size_t>(m_flush_queue.size() - m_flush_pos, m_flush_hdrs.size());
+            for(size_t i = 0; i < count; ++i)
+            {
+                auto& dgram = m_flush_queue[m_flush_pos + i];
+                m_flush_iovs[i].iov_base = m_flush_data.data() + dgram.offset;
+                m_flush_iovs[i].iov_len = dgram.size;
+
+                std::memset(&m_flush_hdrs[i], 0, sizeof(mmsghdr));
+                m_flush_hdrs[i].msg_hdr.msg_name = dgram.receiver.data();
+                m_flush_hdrs[i].msg_hdr.msg_namelen = dgram.receiver.size();
+                m_flush_hdrs[i].msg_hdr.msg_iov = &m_flush_iovs[i];
+                m_flush_hdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int sent = ::sendmmsg(m_sock.native_handle(), m_flush_hdrs.data(), count, MSG_DONTWAIT);
+            if(sent < 0)
+            {
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    // Socket buffer is full, resume when there's room
+                    m_sock.async_wait(
+                        ip::udp::socket::wait_write,
+                        boost::bind(&udp_server::send_ready_token, this, placeholders::error)
+                    );
+                    return;
+                }
+                if(errno == EINTR)
+                    continue;
+
+                // Skip the datagram that can't be sent
+                auto& dgram = m_flush_queue[m_flush_pos];
+                spdlog::error("({0}:{1}) Send to {2}:{3} failed: {4}",
+                    m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+                    dgram.receiver.address().to_string(), dgram.receiver.port(),
+                    std::strerror(errno)
+                );
+                m_dgrams_dropped.add();
+                ++m_flush_pos;
+                continue;
+            }
+
+            if(spdlog::should_log(spdlog::level::debug))
+            {
+                spdlog::debug("({0}:{1}) Sent {2} datagrams",
+                    m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(), sent
+                );
+            }
+            m_dgrams_out.add(sent);
+            m_flush_pos += sent;
+        }
+
+        m_flush_queue.clear();
+        m_flush_data.clear();
+        m_flush_pos = 0;
+
+        // Take whatever has been queued in the meantime
+        std::lock_guard l(m_out_mx);
+        if(m_out_queue.empty())
+        {
+            m_is_flushing = false;
+            return;
+        }
+        std::swap(m_out_queue, m_flush_queue);
+        std::swap(m_out_data, m_flush_data);
+    }
+}
+
+void udp_server::send_ready_token(const boost::system::error_code& ec)
 {
     if(ec)
     {
-        spdlog::error("({0}:{1}) Send to {2}:{3} failed",
-            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
-            receiver.address().to_string(), receiver.port()
+        // Usually the socket has been closed, so its address may be unknown
+        boost::system::error_code ep_ec;
+        auto local_ep = m_sock.local_endpoint(ep_ec);
+        spdlog::debug("({0}:{1}) Stopped waiting for send buffer space: {2}",
+            local_ep.address().to_string(), local_ep.port(), ec.message()
         );
+
+        // The rest of the flush is dropped, the next one starts from scratch
+        m_dgrams_dropped.add(m_flush_queue.size() - m_flush_pos);
+        m_flush_queue.clear();
+        m_flush_data.clear();
+        m_flush_pos = 0;
+
+        std::lock_guard l(m_out_mx);
+        m_is_flushing = false;
+        return;
     }
-    else
+
+    transmit();
+}
+
+void udp_server::start_receive()
+{
+    if(m_batch_size > 1)
     {
-        spdlog::debug("({0}:{1}) Send {2} bytes to {3}:{4}",
-            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
-            bytes_count,
-            receiver.address().to_string(), receiver.port()
+        // Wait for readiness only, datagrams are read with recvmmsg
+        m_sock.async_wait(
+            ip::udp::socket::wait_read,
+            boost::bind(&udp_server::batch_recv_token, this, placeholders::error)
         );
+        return;
     }
+
+    m_sock.async_receive_from(
+        buffer(m_recv_buf.data(), RECV_BUF_SIZE), m_remote_ep,
+        boost::bind(&udp_server::recv_token, this, placeholders::error, placeholders::bytes_transferred)
+    );
 }
 
 void udp_server::recv_token(
@@ -67,29 +284,357 @@ void udp_server::recv_token(
         return;
     }
 
-    spdlog::trace("({0}:{1}) Received message from {2}:{3}",
-        m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
-        m_remote_ep.address().to_string(), m_remote_ep.port()
-    );
+    if(spdlog::should_log(spdlog::level::trace))
+    {
+        spdlog::trace("({0}:{1}) Received message from {2}:{3}",
+            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+            m_remote_ep.address().to_string(), m_remote_ep.port()
+        );
+    }
 
     using namespace std::chrono;
     uint64_t curr_time_us =
         duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
 
     // Notify everyone who wants to handle requests
-    incoming_req_evt.invoke(
-        utf::scheduling::client_request(
+    utf::scheduling::client_request req(
+        m_id, curr_time_us,
+        m_remote_ep.address().to_v4(), m_remote_ep.port(),
+        m_recv_buf.begin(), m_recv_buf.begin() + bytes_count
+    );
+    m_dgrams_in.add();
+    incoming_req_dlg.invoke(req);
+    incoming_req_evt.invoke(req);
+
+    start_receive();
+}
+
+void udp_server::batch_recv_token(const boost::system::error_code& ec)
+{
+    if(ec)
+    {
+        if(ec != boost::asio::error::operation_aborted)
+        {
+            spdlog::error("({0}:{1}) Receive error: {2}",
+                m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+                ec.message()
+            );
+        }
+        return;
+    }
+
+    // Message headers are overwritten by every call
+    for(uint32_t i = 0; i < m_batch_size; ++i)
+    {
+        std::memset(&m_batch_hdrs[i], 0, sizeof(mmsghdr));
+        m_batch_hdrs[i].msg_hdr.msg_name = &m_batch_addrs[i];
+        m_batch_hdrs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        m_batch_hdrs[i].msg_hdr.msg_iov = &m_batch_iovs[i];
+        m_batch_hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int count = ::recvmmsg(m_sock.native_handle(), m_batch_hdrs.data(), m_batch_size, MSG_DONTWAIT, nullptr);
+    if(count < 0)
+    {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            spdlog::error("({0}:{1}) Receive error: {2}",
+                m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+                std::strerror(errno)
+            );
+        }
+        start_receive();
+        return;
+    }
+
+    if(spdlog::should_log(spdlog::level::trace))
+    {
+        spdlog::trace("({0}:{1}) Received a batch of {2} messages",
+            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(), count
+        );
+    }
+
+    // One timestamp for the whole batch
+    using namespace std::chrono;
+    uint64_t curr_time_us =
+        duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+
+    m_batch.clear();
+    for(int i = 0; i < count; ++i)
+    {
+        const auto& addr = m_batch_addrs[i];
+        const char* begin = static_cast<const char*>(m_batch_iovs[i].iov_base);
+        size_t len = std::min<size_t>(m_batch_hdrs[i].msg_len, RECV_BUF_SIZE);
+
+        m_batch.emplace_back(
             m_id, curr_time_us,
-            m_remote_ep.address().to_v4(), m_remote_ep.port(),
-            m_recv_buf.begin(), m_recv_buf.begin() + bytes_count
-        )
+            ip::address_v4(ntohl(addr.sin_addr.s_addr)), ntohs(addr.sin_port),
+            begin, begin + len
+        );
+    }
+
+    m_dgrams_in.add(count);
+
+    // Hand the whole batch over at once
+    incoming_batch_dlg.invoke(std::span<utf::scheduling::client_request>(m_batch));
+    incoming_batch_evt.invoke(std::span<utf::scheduling::client_request>(m_batch));
+
+    start_receive();
+}
+
+void udp_server::start_uring()
+{
+    if(!uring::is_supported())
+        throw std::runtime_error("the kernel has no multishot receive");
+
+    m_uring = std::make_unique<uring>(m_sock.get_executor(), URING_ENTRIES);
+
+    // Every buffer takes a whole datagram along with its source address
+    m_uring_bufs = std::make_unique<uring_buffer_ring>(
+        *m_uring, 0, URING_RECV_BUFFERS, sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + RECV_BUF_SIZE
     );
-    
-    m_sock.async_receive_from(
-        buffer(m_recv_buf), m_remote_ep,
-        boost::bind(&udp_server::recv_token, this, placeholders::error, placeholders::bytes_transferred)
+
+    // Only name and payload are received, the header is a template for all the datagrams
+    std::memset(&m_uring_recv_hdr, 0, sizeof(m_uring_recv_hdr));
+    m_uring_recv_hdr.msg_namelen = sizeof(sockaddr_in);
+
+    m_batch.reserve(m_batch_size);
+
+    uring_receive();
+    int res = m_uring->submit();
+    if(res < 0)
+        throw std::runtime_error(std::string("io_uring_enter: ") + std::strerror(-res));
+
+    spdlog::debug("({0}:{1}) Receiving with io_uring, buffers are {2}",
+        m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+        m_uring_bufs->is_ring_mapped() ? "in a ring" : "provided by requests"
     );
+
+    m_uring->async_wait(boost::bind(&udp_server::uring_token, this));
+}
+
+void udp_server::uring_receive()
+{
+    // A single request keeps receiving until it runs out of buffers
+    auto* sqe = m_uring->get_sqe();
+    if(!sqe)
+    {
+        spdlog::error("({0}:{1}) Can't queue receive, submission queue is full",
+            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port()
+        );
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = m_sock.native_handle();
+    sqe->addr = reinterpret_cast<uint64_t>(&m_uring_recv_hdr);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_uring_bufs->group_id();
+    sqe->user_data = URING_RECV;
+}
+
+void udp_server::uring_token()
+{
+    if(m_is_stopped.load() || !m_sock.is_open())
+        return;
+
+    // One timestamp for everything received since the last time
+    using namespace std::chrono;
+    uint64_t curr_time_us =
+        duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+
+    bool is_receiving = true;
+    bool has_sent = false;
+    m_batch.clear();
+    m_uring->reap(
+        [this, curr_time_us, &is_receiving, &has_sent](const io_uring_cqe& cqe)
+        {
+            switch(cqe.user_data)
+            {
+                case URING_RECV:
+                    is_receiving = uring_recv_completion(cqe, curr_time_us);
+                    break;
+                case URING_SEND:
+                    --m_uring_sends;
+                    has_sent = true;
+                    if(cqe.res < 0)
+                    {
+                        spdlog::debug("({0}:{1}) Send failed: {2}",
+                            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+                            std::strerror(-cqe.res)
+                        );
+                        m_dgrams_dropped.add();
+                    }
+                    else
+                        m_dgrams_out.add();
+                    break;
+                default:
+                    // Buffers given back to the kernel, cancellation
+                    break;
+            }
+        }
+    );
+    deliver_batch();
+
+    if(!is_receiving)
+        uring_receive();
+    if(has_sent)
+        uring_transmit();
+
+    // Recycled buffers, the receive and the sends go in a single system call
+    int res = m_uring->submit();
+    if(res < 0)
+    {
+        spdlog::error("({0}:{1}) io_uring submission failed: {2}",
+            m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+            std::strerror(-res)
+        );
+    }
+
+    m_uring->async_wait(boost::bind(&udp_server::uring_token, this));
+}
+
+// Returns false if the multishot receive is over and has to be renewed
+bool udp_server::uring_recv_completion(const io_uring_cqe& cqe, uint64_t curr_time_us)
+{
+    bool is_armed = cqe.flags & IORING_CQE_F_MORE;
+
+    if(cqe.res < 0)
+    {
+        // Out of buffers, the receive is renewed once they are recycled
+        if(cqe.res == -ENOBUFS)
+            return false;
+
+        // Other errors stop receiving, as they do with asio
+        if(cqe.res != -ECANCELED)
+        {
+            spdlog::error("({0}:{1}) Receive error: {2}",
+                m_sock.local_endpoint().address().to_string(), m_sock.local_endpoint().port(),
+                std::strerror(-cqe.res)
+            );
+        }
+        return true;
+    }
+
+    if(!(cqe.flags & IORING_CQE_F_BUFFER))
+        return is_armed;
+
+    // Buffer layout: [io_uring_recvmsg_out][name][control][payload]
+    uint16_t buf_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    const char* buf = m_uring_bufs->buffer(buf_id);
+    const auto* out = reinterpret_cast<const io_uring_recvmsg_out*>(buf);
+    const char* name = buf + sizeof(io_uring_recvmsg_out);
+    const char* begin = name + m_uring_recv_hdr.msg_namelen + m_uring_recv_hdr.msg_controllen;
+    size_t len = std::min<size_t>(out->payloadlen, buf + cqe.res - begin);
+
+    if(out->namelen >= sizeof(sockaddr_in))
+    {
+        sockaddr_in addr;
+        std::memcpy(&addr, name, sizeof(addr));
+
+        m_batch.emplace_back(
+            m_id, curr_time_us,
+            ip::address_v4(ntohl(addr.sin_addr.s_addr)), ntohs(addr.sin_port),
+            begin, begin + len
+        );
+        m_dgrams_in.add();
+    }
+
+    // Payload has been copied, the buffer can take the next datagram
+    m_uring_bufs->recycle(buf_id);
+
+    if(m_batch.size() >= m_batch_size)
+        deliver_batch();
+
+    return is_armed;
+}
+
+void udp_server::deliver_batch()
+{
+    if(m_batch.empty())
+        return;
+
+    if(m_batch_size > 1)
+    {
+        incoming_batch_dlg.invoke(std::span<utf::scheduling::client_request>(m_batch));
+        incoming_batch_evt.invoke(std::span<utf::scheduling::client_request>(m_batch));
+    }
+    else
+    {
+        for(const auto& req : m_batch)
+        {
+            incoming_req_dlg.invoke(req);
+            incoming_req_evt.invoke(req);
+        }
+    }
+    m_batch.clear();
 }
 
+void udp_server::uring_transmit()
+{
+    for(;;)
+    {
+        // Message headers live until their sends complete, one per datagram of the flush
+        if(m_flush_pos == 0 && m_uring_sends == 0)
+        {
+            m_uring_send_hdrs.resize(m_flush_queue.size());
+            m_flush_iovs.resize(m_flush_queue.size());
+        }
+
+        while(m_flush_pos < m_flush_queue.size() && m_uring_sends < URING_MAX_SENDS)
+        {
+            auto* sqe = m_uring->get_sqe();
+            if(!sqe)
+            {
+                // The kernel doesn't take requests, the rest of the flush is lost
+                m_dgrams_dropped.add(m_flush_queue.size() - m_flush_pos);
+                m_flush_pos = m_flush_queue.size();
+                break;
+            }
+
+            auto& dgram = m_flush_queue[m_flush_pos];
+            auto& iov = m_flush_iovs[m_flush_pos];
+            auto& hdr = m_uring_send_hdrs[m_flush_pos];
+            iov.iov_base = m_flush_data.data() + dgram.offset;
+            iov.iov_len = dgram.size;
+
+            std::memset(&hdr, 0, sizeof(msghdr));
+            hdr.msg_name = dgram.receiver.data();
+            hdr.msg_namelen = dgram.receiver.size();
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = m_sock.native_handle();
+            sqe->addr = reinterpret_cast<uint64_t>(&hdr);
+            sqe->len = 1;
+            sqe->user_data = URING_SEND;
+
+            ++m_flush_pos;
+            ++m_uring_sends;
+        }
+
+        // Completions of the sends in flight bring the rest
+        if(m_uring_sends > 0 || m_flush_pos < m_flush_queue.size())
+            return;
+
+        m_flush_queue.clear();
+        m_flush_data.clear();
+        m_flush_pos = 0;
+
+        // Take whatever has been queued in the meantime
+        std::lock_guard l(m_out_mx);
+        if(m_out_queue.empty())
+        {
+            m_is_flushing = false;
+            return;
+        }
+        std::swap(m_out_queue, m_flush_queue);
+        std::swap(m_out_data, m_flush_data);
+    }
+}
+
+}
 }
-}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "event.h"
+#include "delegate.h"
+#include "edr_logger.h"
+
+#include "endpoints/include/endpoint_impl.h"
+
+#include "client_request.h"
+#include "server_response.h"
+#include "forwarder.h"
+#include "mpsc_queue.h"
+#include "wakeup.h"
+#include "slot_table.h"
+#include "metrics.h"
+
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace utf
+{
+namespace scheduling
+{
+
+struct forwarder_options
+{
+    wakeup_mode wakeup = wakeup_mode::park;
+    uint32_t spin_us = 0;
+
+    // Capacity of both incoming requests and responses queues
+    size_t queue_capacity = 65536;
+
+    // Relative weights of backends, in the order of the clients list (weighted schedulers only)
+    std::vector<uint32_t> weights;
+
+    // Called on the forwarder's thread before the main loop starts (e.g. to pin it)
+    std::function<void()> thread_init;
+};
+
+// Queues, request bookkeeping and the main loop shared by all forwarders.
+// Derived classes only decide which backend gets the next request.
+// Every hook is called on the forwarder's own thread.
+class basic_forwarder : public forwarder
+{
+protected:
+    // Server address is the backend's, so it isn't stored per request
+    struct pending_request
+    {
+        uint64_t arrival_time_ms;
+        uint64_t fwd_time_us;
+        uint32_t listener_id;
+        uint32_t backend;
+        boost::asio::ip::address_v4 client_addr;
+        uint16_t client_port;
+    };
+
+    using clients_t = std::vector<std::shared_ptr<endpoints::tcp_client_pool>>;
+
+    // Returned by select_backend() when no backend can take the request
+    static constexpr size_t NO_BACKEND = std::numeric_limits<size_t>::max();
+
+public:
+    basic_forwarder() = delete;
+    ~basic_forwarder() override;
+
+    // Final, so delegates bound to them call them directly rather than through the vtable
+    void schedule(const client_request& req) final;
+    void schedule(client_request&& req) final;
+    void schedule(std::span<client_request> reqs) final;
+
+    // Bound once at startup, called before the event's subscribers
+    delegate<uint32_t, boost::asio::ip::address_v4, uint16_t, const aux::byte_buffer&> send_back_dlg;
+    event<uint32_t, boost::asio::ip::address_v4, uint16_t, const aux::byte_buffer&> send_back_evt;
+    event<const aux::edr&> edr_report_evt;
+
+protected:
+    basic_forwarder(clients_t&& clients, const forwarder_options& opts);
+
+    // Derived constructors start the main loop once they're done,
+    // derived destructors stop it before their members are gone
+    void start();
+    void stop();
+
+    // Index of the backend for the request, NO_BACKEND if none is available
+    virtual size_t select_backend(const client_request& req) = 0;
+
+    // Request has been handed to the backend
+    virtual void on_forwarded(size_t backend) {}
+
+    // Response has arrived or the request has timed out (response_time_us is TIMESTAMP_TIMEOUT)
+    virtual void on_completed(const pending_request& pr, uint64_t response_time_us) {}
+
+    clients_t m_clients;
+
+private:
+    void accept_response(const server_response& response);
+    bool forward_requests();
+    void send_responses();
+    void report(const pending_request& pr, uint64_t response_time_us);
+
+    void main_loop();
+
+    // Keyed by request id, which is the slot index plus its generation
+    aux::slot_table<pending_request> m_pending_reqs;
+    // Filled by UDP servers and TCP clients, drained by the main loop only
+    mpsc_queue<client_request> m_requests;
+    mpsc_queue<server_response> m_responses;
+
+    std::atomic_uint64_t m_dropped_reqs = 0;
+
+    // Wakes up the main loop when requests or responses are queued
+    work_signal m_work_sig;
+
+    struct backend_metrics
+    {
+        aux::metrics::histogram* resp_time_us;
+        aux::metrics::counter* timeouts;
+    };
+
+    // Indexed by backend
+    std::vector<backend_metrics> m_backend_metrics;
+
+    // Queue depths are read on every scrape, pending requests are counted by the main loop
+    aux::metrics::gauge& m_requests_depth;
+    aux::metrics::gauge& m_responses_depth;
+    aux::metrics::gauge& m_pending_count;
+    uint64_t m_depth_collector;
+    aux::metrics::counter& m_dropped_metric;
+
+    // Runs first on the main loop's thread
+    std::function<void()> m_thread_init;
+
+    std::future<void> m_stop_sync;
+    std::atomic_bool m_is_stopped = false;
+};
+
+}
+}
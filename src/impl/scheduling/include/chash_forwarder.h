@@ -0,0 +1,34 @@
+#pragma once
+
+#include "basic_forwarder.h"
+
+#include <utility>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Sticky routing: requests of a UDP client (address and port) always go to the same backend.
+// Backends are placed on a hash ring as a number of virtual nodes each. A client is served
+// by the first connected backend clockwise from its hash, so when a backend goes down
+// only its own clients move, and they are spread over the rest of the ring.
+class chash_forwarder : public basic_forwarder
+{
+public:
+    chash_forwarder() = delete;
+    chash_forwarder(
+        std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+        const forwarder_options& opts = forwarder_options{}
+    );
+    ~chash_forwarder() override;
+
+private:
+    size_t select_backend(const client_request& req) override;
+
+    // Virtual nodes as <hash, backend index>, sorted by hash
+    std::vector<std::pair<uint64_t, uint32_t>> m_ring;
+};
+
+}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "basic_forwarder.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+std::shared_ptr<basic_forwarder> make_forwarder(
+    scheduler_t scheduler,
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts = forwarder_options{}
+);
+
+}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "basic_forwarder.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Sends every request to the connected backend with the fewest requests in flight,
+// ties are broken round-robin. Slow backends collect in-flight requests and get less traffic.
+class lor_forwarder : public basic_forwarder
+{
+public:
+    lor_forwarder() = delete;
+    lor_forwarder(
+        std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+        const forwarder_options& opts = forwarder_options{}
+    );
+    ~lor_forwarder() override;
+
+private:
+    size_t select_backend(const client_request& req) override;
+    void on_forwarded(size_t backend) override;
+    void on_completed(const pending_request& pr, uint64_t response_time_us) override;
+
+    // Requests sent to a backend and not answered (or timed out) yet
+    std::vector<uint64_t> m_in_flight;
+    size_t m_next_client = 0;
+};
+
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "basic_forwarder.h"
+
+#include <random>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Power of two choices: samples two connected backends at random and picks the cheaper one,
+// cost being the backend's peak-EWMA response time multiplied by its load.
+// Peak-EWMA jumps up to any slower sample right away and decays back slowly,
+// so a backend that starts lagging is avoided before its timeouts pile up.
+class p2c_forwarder : public basic_forwarder
+{
+public:
+    p2c_forwarder() = delete;
+    p2c_forwarder(
+        std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+        const forwarder_options& opts = forwarder_options{}
+    );
+    ~p2c_forwarder() override;
+
+private:
+    struct backend_stats
+    {
+        // Peak-EWMA of response time
+        double ewma_us = 0;
+        uint64_t last_sample_us = 0;
+
+        // Requests sent to the backend and not answered (or timed out) yet
+        uint64_t in_flight = 0;
+    };
+
+    size_t select_backend(const client_request& req) override;
+    void on_forwarded(size_t backend) override;
+    void on_completed(const pending_request& pr, uint64_t response_time_us) override;
+
+    double cost(size_t backend) const;
+
+    std::vector<backend_stats> m_stats;
+    std::minstd_rand m_rand_eng;
+};
+
+}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "basic_forwarder.h"
+#include "wrr_schedule.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Weighted round robin over connected backends, weights come from forwarder_options
+class wrr_forwarder : public basic_forwarder
+{
+public:
+    wrr_forwarder() = delete;
+    wrr_forwarder(
+        std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+        const forwarder_options& opts = forwarder_options{}
+    );
+    ~wrr_forwarder() override;
+
+private:
+    size_t select_backend(const client_request& req) override;
+
+    wrr_schedule m_schedule;
+};
+
+}
+}
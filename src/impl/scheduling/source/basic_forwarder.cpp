@@ -0,0 +1,310 @@
+#include "basic_forwarder.h"
+
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <exception>
+#include <thread>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// How often requests are retried while no TCP server is connected
+static constexpr auto NO_CLIENTS_RETRY_INTERVAL = std::chrono::milliseconds(10);
+
+basic_forwarder::basic_forwarder(clients_t&& clients, const forwarder_options& opts) :
+    m_clients(clients),
+    m_pending_reqs(opts.queue_capacity),
+    m_requests(opts.queue_capacity),
+    m_responses(opts.queue_capacity),
+    m_work_sig(opts.wakeup, opts.spin_us),
+    m_requests_depth(aux::metrics::registry::global().make_gauge(
+        "utf_forwarder_requests_queue_depth", "Requests waiting to be forwarded")),
+    m_responses_depth(aux::metrics::registry::global().make_gauge(
+        "utf_forwarder_responses_queue_depth", "Responses waiting to be sent back")),
+    m_pending_count(aux::metrics::registry::global().make_gauge(
+        "utf_forwarder_pending_requests", "Requests forwarded and not answered yet")),
+    m_dropped_metric(aux::metrics::registry::global().make_counter(
+        "utf_forwarder_dropped_requests_total", "Requests dropped due to full queue")),
+    m_thread_init(opts.thread_init)
+{
+    if(m_clients.empty())
+        throw std::runtime_error("forwarder: Empty clients list");
+
+    auto& reg = aux::metrics::registry::global();
+
+    // Sizes of lock-free queues can be read from any thread
+    m_depth_collector = reg.add_collector(
+        [this]()
+        {
+            m_requests_depth.set(m_requests.size());
+            m_responses_depth.set(m_responses.size());
+        }
+    );
+
+    for(const auto& cl : m_clients)
+    {
+        aux::metrics::labels_t labels{{"backend", cl->get_address().to_string() + ":" + std::to_string(cl->get_port())}};
+        m_backend_metrics.push_back(backend_metrics
+        {
+            .resp_time_us = &reg.make_histogram(
+                "utf_backend_response_seconds", "Response time of TCP servers", 1e6, labels),
+            .timeouts = &reg.make_counter(
+                "utf_backend_timeouts_total", "Requests TCP servers haven't answered in time", labels)
+        });
+    }
+}
+
+basic_forwarder::~basic_forwarder()
+{
+    aux::metrics::registry::global().remove_collector(m_depth_collector);
+
+    // Pending requests are only touched by the main loop, nothing else to wait for
+    stop();
+
+    if(m_dropped_reqs.load() > 0)
+    {
+        spdlog::warn("{0} requests were dropped due to full queue", m_dropped_reqs.load());
+    }
+
+    // Write reports for remaining requests (with timeout message)
+    m_pending_reqs.for_each([this](uint64_t rid, const pending_request& pr)
+    {
+        report(pr, TIMESTAMP_TIMEOUT);
+    });
+}
+
+void basic_forwarder::start()
+{
+    // Subscribe our acceptor to every client's giveaway event
+    for(const auto& cl : m_clients)
+    {
+        cl->resp_giveaway_evt.subscribe(this, &basic_forwarder::accept_response);
+    }
+
+    m_stop_sync = std::async(
+        &basic_forwarder::main_loop,
+        this
+    );
+}
+
+void basic_forwarder::stop()
+{
+    if(!m_stop_sync.valid())
+        return;
+
+    m_is_stopped.store(true);
+    m_work_sig.notify();
+    m_stop_sync.get();
+}
+
+void basic_forwarder::schedule(const client_request& req)
+{
+    schedule(client_request(req));
+}
+
+void basic_forwarder::schedule(client_request&& req)
+{
+    // Datagrams may be lost anyway, so don't hold the UDP server back
+    if(!m_requests.try_push(std::move(req)))
+    {
+        m_dropped_metric.add();
+        if(m_dropped_reqs.fetch_add(1) == 0)
+        {
+            spdlog::warn("Requests queue is full, dropping requests");
+        }
+        return;
+    }
+    m_work_sig.notify();
+}
+
+void basic_forwarder::schedule(std::span<client_request> reqs)
+{
+    size_t pushed = 0;
+    for(auto& req : reqs)
+    {
+        if(!m_requests.try_push(std::move(req)))
+            break;
+        ++pushed;
+    }
+
+    if(pushed < reqs.size())
+    {
+        m_dropped_metric.add(reqs.size() - pushed);
+        if(m_dropped_reqs.fetch_add(reqs.size() - pushed) == 0)
+        {
+            spdlog::warn("Requests queue is full, dropping requests");
+        }
+    }
+
+    // Wake the main loop once per batch
+    if(pushed > 0)
+        m_work_sig.notify();
+}
+
+void basic_forwarder::accept_response(const server_response& response)
+{
+    // Responses must not be lost, hold the TCP client back until there's room.
+    // It must not hold locks here the main loop may wait on while sending, or neither side moves.
+    while(!m_responses.try_push(response))
+    {
+        if(m_is_stopped.load())
+            return;
+
+        m_work_sig.notify();
+        std::this_thread::yield();
+    }
+    m_work_sig.notify();
+}
+
+bool basic_forwarder::forward_requests()
+{
+    while(auto* front = m_requests.front())
+    {
+        auto& req = *front;
+
+        size_t backend = select_backend(req);
+        if(backend == NO_BACKEND)
+            return false;
+
+        auto& client = m_clients[backend];
+
+        // Get timestamp and fill pending request info, then store the latter
+        using namespace chrono;
+        uint64_t current_time_us =
+            duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+        pending_request pr
+        {
+            .arrival_time_ms = req.arr_timestamp_ms,
+            .fwd_time_us = current_time_us,
+            .listener_id = req.listener_id,
+            .backend = static_cast<uint32_t>(backend),
+            .client_addr = req.client_addr,
+            .client_port = req.client_port
+        };
+        uint64_t rid = m_pending_reqs.insert(pr);
+
+        spdlog::trace("Scheduled request #{0:x}: {1}:{2} -> {3}:{4}",
+            rid,
+            pr.client_addr.to_string(), pr.client_port,
+            client->get_address().to_string(), client->get_port()
+        );
+
+        if(client->send(rid, std::move(req.payload)) == 0)
+        {
+            on_forwarded(backend);
+        }
+        else
+        {
+            // Backend won't answer a request it hasn't taken, don't wait for it
+            m_pending_reqs.erase(rid);
+            spdlog::debug("Request #{0:x} couldn't be sent", rid);
+            report(pr, TIMESTAMP_TIMEOUT);
+        }
+        m_requests.pop();
+    }
+    return true;
+}
+
+void basic_forwarder::send_responses()
+{
+    while(auto* front = m_responses.front())
+    {
+        const auto& resp = *front;
+
+        // Find the associated entry and remove it if it exists
+        auto* entry = m_pending_reqs.find(resp.request_id);
+        if(entry == nullptr)
+        {
+            spdlog::warn("Unknown request #{0:x}", resp.request_id);
+
+            m_responses.pop();
+            continue;
+        }
+        pending_request pr = *entry;
+        m_pending_reqs.erase(resp.request_id);
+
+        auto response_time_us =
+            (resp.resp_timestamp_us == TIMESTAMP_TIMEOUT) ?
+            TIMESTAMP_TIMEOUT : (resp.resp_timestamp_us - pr.fwd_time_us);
+
+        auto& metrics = m_backend_metrics[pr.backend];
+        if(response_time_us == TIMESTAMP_TIMEOUT)
+            metrics.timeouts->add();
+        else
+            metrics.resp_time_us->record(response_time_us);
+
+        on_completed(pr, response_time_us);
+        report(pr, response_time_us);
+
+        if(resp.resp_timestamp_us != TIMESTAMP_TIMEOUT)
+        {
+            const auto& client = m_clients[pr.backend];
+            spdlog::trace("Sending request #{0:x} back from {1}:{2} to {3}:{4}",
+                resp.request_id,
+                client->get_address().to_string(), client->get_port(),
+                pr.client_addr.to_string(), pr.client_port
+            );
+            send_back_dlg.invoke(pr.listener_id, pr.client_addr, pr.client_port, resp.payload);
+            send_back_evt.invoke(pr.listener_id, pr.client_addr, pr.client_port, resp.payload);
+        }
+        else
+        {
+            spdlog::warn("Request #{0:x} has expired", resp.request_id);
+        }
+        m_responses.pop();
+    }
+}
+
+void basic_forwarder::report(const pending_request& pr, uint64_t response_time_us)
+{
+    // Build EDR report and notify listeners
+    const auto& client = m_clients[pr.backend];
+    aux::edr edr
+    {
+        .arrival_time_ms = pr.arrival_time_ms,
+        .tcp_resp_dur_us = response_time_us,
+        .client_addr = pr.client_addr,
+        .server_addr = client->get_address(),
+        .client_port = pr.client_port,
+        .server_port = client->get_port()
+    };
+    edr_report_evt.invoke(edr);
+}
+
+void basic_forwarder::main_loop()
+{
+    if(m_thread_init)
+        m_thread_init();
+
+    for(;;)
+    {
+        // Anything queued after this point will trigger another iteration
+        m_work_sig.reset();
+
+        if(m_is_stopped.load())
+            break;
+
+        bool is_drained = forward_requests();
+        send_responses();
+
+        m_pending_count.set(m_pending_reqs.size());
+
+        // Sleep until new work arrives, or retry later if requests are stuck
+        if(is_drained)
+            m_work_sig.wait();
+        else
+            m_work_sig.wait_for(NO_CLIENTS_RETRY_INTERVAL);
+    }
+
+    spdlog::debug("Cleaning up TCP clients' response handlers");
+    for(const auto& cl : m_clients)
+    {
+        cl->resp_giveaway_evt.unsubscribe(this, &basic_forwarder::accept_response);
+    }
+}
+
+}
+}
@@ -0,0 +1,74 @@
+#include "chash_forwarder.h"
+
+#include <algorithm>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Enough to keep the load of every backend within a few percent of the average
+static constexpr uint32_t VIRTUAL_NODES_PER_BACKEND = 160;
+
+// SplitMix64 finalizer, spreads close keys (e.g. adjacent ports) over the whole ring
+static uint64_t mix(uint64_t key)
+{
+    key += 0x9e3779b97f4a7c15ull;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+static uint64_t endpoint_key(const boost::asio::ip::address_v4& addr, uint16_t port)
+{
+    return (static_cast<uint64_t>(addr.to_uint()) << 16) | port;
+}
+
+chash_forwarder::chash_forwarder(
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts
+) :
+    basic_forwarder(std::move(clients), opts)
+{
+    // Nodes depend on the backend's address, not its position in the config,
+    // so reordering backends doesn't move clients
+    m_ring.reserve(m_clients.size() * VIRTUAL_NODES_PER_BACKEND);
+    for(uint32_t i = 0; i < m_clients.size(); ++i)
+    {
+        uint64_t key = endpoint_key(m_clients[i]->get_address(), m_clients[i]->get_port());
+        for(uint64_t vn = 0; vn < VIRTUAL_NODES_PER_BACKEND; ++vn)
+            m_ring.emplace_back(mix(key ^ mix(vn)), i);
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+
+    start();
+}
+
+chash_forwarder::~chash_forwarder()
+{
+    stop();
+}
+
+size_t chash_forwarder::select_backend(const client_request& req)
+{
+    uint64_t hash = mix(endpoint_key(req.client_addr, req.client_port));
+
+    // O(log n) search for the first node clockwise
+    auto it = std::lower_bound(m_ring.begin(), m_ring.end(), hash,
+        [](const std::pair<uint64_t, uint32_t>& node, uint64_t h){return node.first < h;}
+    );
+
+    // Walk past nodes of disconnected backends
+    for(size_t i = 0; i < m_ring.size(); ++i, ++it)
+    {
+        if(it == m_ring.end())
+            it = m_ring.begin();
+
+        if(m_clients[it->second]->is_connected())
+            return it->second;
+    }
+    return NO_BACKEND;
+}
+
+}
+}
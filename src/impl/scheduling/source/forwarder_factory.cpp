@@ -0,0 +1,36 @@
+#include "forwarder_factory.h"
+#include "rr_forwarder.h"
+#include "lor_forwarder.h"
+#include "p2c_forwarder.h"
+#include "chash_forwarder.h"
+#include "wrr_forwarder.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+std::shared_ptr<basic_forwarder> make_forwarder(
+    scheduler_t scheduler,
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts
+)
+{
+    switch(scheduler)
+    {
+        case scheduler_t::least_outstanding:
+            return std::make_shared<lor_forwarder>(std::move(clients), opts);
+        case scheduler_t::p2c_ewma:
+            return std::make_shared<p2c_forwarder>(std::move(clients), opts);
+        case scheduler_t::consistent_hash:
+            return std::make_shared<chash_forwarder>(std::move(clients), opts);
+        case scheduler_t::weighted_round_robin:
+            return std::make_shared<wrr_forwarder>(std::move(clients), opts);
+        case scheduler_t::round_robin:
+        default:
+            return std::make_shared<rr_forwarder>(std::move(clients), opts);
+    }
+}
+
+}
+}
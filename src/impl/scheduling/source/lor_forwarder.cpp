@@ -0,0 +1,59 @@
+#include "lor_forwarder.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+lor_forwarder::lor_forwarder(
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts
+) :
+    basic_forwarder(std::move(clients), opts),
+    m_in_flight(m_clients.size(), 0)
+{
+    start();
+}
+
+lor_forwarder::~lor_forwarder()
+{
+    stop();
+}
+
+size_t lor_forwarder::select_backend(const client_request& req)
+{
+    // Scan starts from a rotating position, so the first of equally loaded backends changes
+    size_t best = NO_BACKEND;
+    for(size_t i = 0; i < m_clients.size(); ++i)
+    {
+        size_t idx = (m_next_client + i) % m_clients.size();
+        if(!m_clients[idx]->is_connected())
+            continue;
+
+        if(best == NO_BACKEND || m_in_flight[idx] < m_in_flight[best])
+        {
+            best = idx;
+
+            // Can't do better than that
+            if(m_in_flight[idx] == 0)
+                break;
+        }
+    }
+
+    m_next_client = (m_next_client + 1) % m_clients.size();
+    return best;
+}
+
+void lor_forwarder::on_forwarded(size_t backend)
+{
+    ++m_in_flight[backend];
+}
+
+void lor_forwarder::on_completed(const pending_request& pr, uint64_t response_time_us)
+{
+    if(m_in_flight[pr.backend] > 0)
+        --m_in_flight[pr.backend];
+}
+
+}
+}
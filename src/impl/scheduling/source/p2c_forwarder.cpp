@@ -0,0 +1,112 @@
+#include "p2c_forwarder.h"
+
+#include <chrono>
+#include <cmath>
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Time it takes the EWMA to forget about ~63% of its past
+static constexpr double EWMA_DECAY_TIME_US = 10'000'000.0;
+
+// Assumed response time of a backend that hasn't answered anything yet
+static constexpr double INITIAL_RESPONSE_TIME_US = 1'000.0;
+
+// How many random pairs to try before looking for any connected backend
+static constexpr size_t SAMPLING_ATTEMPTS = 4;
+
+p2c_forwarder::p2c_forwarder(
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts
+) :
+    basic_forwarder(std::move(clients), opts),
+    m_stats(m_clients.size()),
+    m_rand_eng(std::random_device{}())
+{
+    start();
+}
+
+p2c_forwarder::~p2c_forwarder()
+{
+    stop();
+}
+
+double p2c_forwarder::cost(size_t backend) const
+{
+    const auto& st = m_stats[backend];
+    double latency_us = st.last_sample_us == 0 ? INITIAL_RESPONSE_TIME_US : st.ewma_us;
+
+    // Requests in flight will be served before the new one
+    return latency_us * (st.in_flight + 1);
+}
+
+size_t p2c_forwarder::select_backend(const client_request& req)
+{
+    size_t count = m_clients.size();
+    if(count == 1)
+        return m_clients.front()->is_connected() ? 0 : NO_BACKEND;
+
+    for(size_t i = 0; i < SAMPLING_ATTEMPTS; ++i)
+    {
+        // Two distinct backends
+        size_t a = m_rand_eng() % count;
+        size_t b = (a + 1 + m_rand_eng() % (count - 1)) % count;
+
+        bool a_conn = m_clients[a]->is_connected();
+        bool b_conn = m_clients[b]->is_connected();
+
+        if(a_conn && b_conn)
+            return cost(a) <= cost(b) ? a : b;
+        if(a_conn)
+            return a;
+        if(b_conn)
+            return b;
+    }
+
+    // Most backends are down, fall back to the cheapest connected one
+    size_t best = NO_BACKEND;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(m_clients[i]->is_connected() && (best == NO_BACKEND || cost(i) < cost(best)))
+            best = i;
+    }
+    return best;
+}
+
+void p2c_forwarder::on_forwarded(size_t backend)
+{
+    ++m_stats[backend].in_flight;
+}
+
+void p2c_forwarder::on_completed(const pending_request& pr, uint64_t response_time_us)
+{
+    auto& st = m_stats[pr.backend];
+    if(st.in_flight > 0)
+        --st.in_flight;
+
+    using namespace std::chrono;
+    uint64_t now_us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+
+    // Timed out request took at least as long as it's been waiting
+    double sample_us = response_time_us == TIMESTAMP_TIMEOUT ?
+        static_cast<double>(now_us - pr.fwd_time_us) : static_cast<double>(response_time_us);
+
+    if(st.last_sample_us == 0 || sample_us > st.ewma_us)
+    {
+        // Peaks are taken as they are
+        st.ewma_us = sample_us;
+    }
+    else
+    {
+        // Older samples weigh less the more time has passed
+        double elapsed_us = now_us > st.last_sample_us ? now_us - st.last_sample_us : 0;
+        double w = std::exp(-elapsed_us / EWMA_DECAY_TIME_US);
+        st.ewma_us = st.ewma_us * w + sample_us * (1.0 - w);
+    }
+    st.last_sample_us = now_us;
+}
+
+}
+}
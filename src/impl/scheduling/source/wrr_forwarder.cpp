@@ -0,0 +1,45 @@
+#include "wrr_forwarder.h"
+
+namespace utf
+{
+namespace scheduling
+{
+
+// Missing weights default to 1
+static std::vector<uint32_t> backend_weights(const std::vector<uint32_t>& weights, size_t count)
+{
+    std::vector<uint32_t> res(count, 1);
+    for(size_t i = 0; i < count && i < weights.size(); ++i)
+        res[i] = weights[i];
+    return res;
+}
+
+wrr_forwarder::wrr_forwarder(
+    std::vector<std::shared_ptr<utf::endpoints::tcp_client_pool>>&& clients,
+    const forwarder_options& opts
+) :
+    basic_forwarder(std::move(clients), opts),
+    m_schedule(backend_weights(opts.weights, m_clients.size()))
+{
+    start();
+}
+
+wrr_forwarder::~wrr_forwarder()
+{
+    stop();
+}
+
+size_t wrr_forwarder::select_backend(const client_request& req)
+{
+    // Turns of disconnected backends are skipped, the rest keep their proportions
+    for(size_t i = 0; i < m_schedule.size(); ++i)
+    {
+        uint32_t idx = m_schedule.next();
+        if(m_clients[idx]->is_connected())
+            return idx;
+    }
+    return NO_BACKEND;
+}
+
+}
+}
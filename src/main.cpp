@@ -1,7 +1,8 @@
 #include "endpoints/include/endpoint_impl.h"
-#include "rr_forwarder.h"
+#include "forwarder_factory.h"
 #include "edr_logger.h"
 #include "configuration.h"
+#include "heap_counter.h"
 
 #include <boost/thread.hpp>
 #include <boost/program_options.hpp>
@@ -17,7 +18,6 @@
 
 enum cb_id
 {
-    send_back,
     log_edr
 };
 
@@ -34,6 +34,13 @@ void sig_handler(int sig)
     destroyer();
 }
 
+// Pins the calling thread as the idx-th of its role, as configured
+void place_thread(const utf::aux::thread_placement& pl, size_t idx, const char* role)
+{
+    if(!utf::aux::place_current_thread(pl, idx))
+        spdlog::warn("Can't place {0} thread {1} as configured", role, idx);
+}
+
 int main(int argc, char** argv)
 {
     // The only option is path to the config
@@ -63,43 +70,102 @@ int main(int argc, char** argv)
 
     spdlog::set_level(config.logging_lvl);
 
-    // Two io_context's - for TCP and UDP each
-    io_context ioc_tcp;
-    io_context ioc_udp;
+    // Checked once here rather than by every endpoint
+    if(config.engine == io_engine::io_uring && !uring::is_supported())
+    {
+        spdlog::warn("io_uring with multishot receive is unavailable, falling back to asio");
+        config.engine = io_engine::asio;
+    }
+
+    // Decide how many TCP threads to use.
+    // Everything below is allocated by this thread before any placement, so numa_local doesn't cover it.
+    const auto& rt = config.runtime;
+    auto conc = std::thread::hardware_concurrency();
+    uint32_t tcp_threads = rt.tcp_threads;
+    if(tcp_threads == 0)
+        tcp_threads = 1 + (conc > 4 ? conc / 4 : 0);    // The default from before tcp_threads existed
+
+    // One io_context for TCP (or one per TCP thread), and one for every UDP shard
+    std::vector<std::unique_ptr<io_context>> iocs_tcp;
+    uint32_t tcp_iocs_count = rt.tcp_io == utf::aux::io_model::per_thread ? tcp_threads : 1;
+    for(uint32_t i = 0; i < tcp_iocs_count; ++i)
+        iocs_tcp.push_back(std::make_unique<io_context>());
+    std::vector<std::unique_ptr<io_context>> iocs_udp;
+    for(uint32_t i = 0; i < config.udp_shards; ++i)
+        iocs_udp.push_back(std::make_unique<io_context>());
 
-    // Populate TCP clients
-    std::vector<std::shared_ptr<tcp_client>> tcp_clients;
+    // Populate TCP client pools, one per server
+    utf::endpoints::tcp_socket_options sock_opts
+    {
+        .no_delay = config.tcp_nodelay,
+        .cork = config.tcp_cork,
+        .engine = config.engine
+    };
+    std::vector<std::shared_ptr<tcp_client_pool>> tcp_clients;
     tcp_clients.reserve(config.tcp_clients.size());
+    size_t conns_count = 0;
     for(const auto& client : config.tcp_clients)
     {
-        tcp_clients.push_back(std::make_shared<tcp_client>(
-            ioc_tcp,
+        // Connections of all the pools are spread evenly across TCP io_context's
+        std::vector<io_context*> pool_iocs;
+        for(size_t i = 0; i < iocs_tcp.size(); ++i)
+            pool_iocs.push_back(iocs_tcp.at((conns_count + i) % iocs_tcp.size()).get());
+        conns_count += client.connections;
+
+        tcp_clients.push_back(std::make_shared<tcp_client_pool>(
+            pool_iocs,
             ip::tcp::endpoint(client.ipv4, client.port),
+            client.connections,
             config.connection_timeout_ms,
-            config.response_timeout_ms
+            config.response_timeout_ms,
+            sock_opts
         ));
     }
 
-    // Populate UDP servers
+    // Populate UDP servers, every port gets a server per shard.
+    // Server index is its listener ID, so replies leave through the shard the request came from.
     std::vector<std::shared_ptr<udp_server>> udp_servers;
-    udp_servers.reserve(config.udp_ports.size());
+    udp_servers.reserve(config.udp_ports.size() * config.udp_shards);
     for(uint32_t i = 0; i < config.udp_ports.size(); ++i)
     {
-        udp_servers.push_back(std::make_shared<udp_server>(
-            ioc_udp, config.udp_ports.at(i), i
-        ));
+        for(uint32_t j = 0; j < config.udp_shards; ++j)
+        {
+            uint32_t id = udp_servers.size();
+            udp_servers.push_back(std::make_shared<udp_server>(
+                *iocs_udp.at(j), config.udp_ports.at(i), id, config.udp_batch_size, config.udp_shards > 1, config.engine
+            ));
+        }
     }
 
-    auto fwdr = std::make_shared<utf::scheduling::rr_forwarder>(std::move(tcp_clients));
+    utf::scheduling::forwarder_options fwdr_opts
+    {
+        .wakeup = config.forwarder_wakeup,
+        .spin_us = config.forwarder_spin_us,
+        .queue_capacity = config.queue_capacity,
+        .thread_init = [pl = rt.forwarder](){place_thread(pl, 0, "forwarder");}
+    };
+    for(const auto& client : config.tcp_clients)
+        fwdr_opts.weights.push_back(client.weight);
+
+    auto fwdr = utf::scheduling::make_forwarder(config.scheduler, std::move(tcp_clients), fwdr_opts);
 
     // Setup EDR logger
     std::shared_ptr<utf::aux::edr_logger> edr_logger = nullptr;
     if(!config.log_file_path.empty())
     {
-        std::ofstream ofs(config.log_file_path);
-        if(ofs.is_open())
+        utf::aux::edr_logger_options edr_opts
         {
-            edr_logger = std::make_shared<utf::aux::edr_logger>(std::move(ofs));
+            .format = config.edr_log_format,
+            .file_records = config.edr_file_records,
+            .queue_capacity = config.queue_capacity,
+            .overflow = config.edr_overflow,
+            .flush_bytes = config.edr_flush_bytes,
+            .flush_interval_ms = config.edr_flush_interval_ms,
+            .thread_init = [pl = rt.edr_writer](){place_thread(pl, 0, "EDR writer");}
+        };
+        try
+        {
+            edr_logger = std::make_shared<utf::aux::edr_logger>(config.log_file_path, edr_opts);
             fwdr->edr_report_evt.subscribe(
                 cb_id::log_edr, 
                 [&edr_logger](const utf::aux::edr& edr)
@@ -108,49 +174,106 @@ int main(int argc, char** argv)
                 }
             );
         }
-    }
-    
-    // Sending responses back from TCP servers to UDP clients
-    fwdr->send_back_evt.subscribe(
-        cb_id::send_back,
-        [&udp_servers](uint32_t id, boost::asio::ip::address_v4 addr, uint16_t port, const std::vector<char>& payload)
+        catch(const std::exception& e)
         {
-            udp_servers.at(id)->send(boost::asio::ip::udp::endpoint(addr, port), payload.begin(), payload.end());
+            spdlog::error("EDRs won't be written: {0}", e.what());
         }
-    );
+    }
+    
+    // Sending responses back from TCP servers to UDP clients, the wiring is fixed, so it's a delegate
+    auto send_back =
+    [&udp_servers](uint32_t id, boost::asio::ip::address_v4 addr, uint16_t port, const utf::aux::byte_buffer& payload)
+    {
+        udp_servers.at(id)->send(boost::asio::ip::udp::endpoint(addr, port), payload.begin(), payload.end());
+    };
+    fwdr->send_back_dlg = decltype(fwdr->send_back_dlg)::bind(&send_back);
 
-    // Subscrube to receive messages from UDP clients
+    // Receive messages from UDP clients
+    using fwdr_t = utf::scheduling::basic_forwarder;
+    using schedule_one_t = void (fwdr_t::*)(const utf::scheduling::client_request&);
+    using schedule_batch_t = void (fwdr_t::*)(std::span<utf::scheduling::client_request>);
     for(const auto& server: udp_servers)
     {
-        server->incoming_req_evt.subscribe(fwdr, &utf::scheduling::rr_forwarder::schedule);
+        server->incoming_req_dlg =
+            decltype(server->incoming_req_dlg)::bind<static_cast<schedule_one_t>(&fwdr_t::schedule)>(fwdr.get());
+        server->incoming_batch_dlg =
+            decltype(server->incoming_batch_dlg)::bind<static_cast<schedule_batch_t>(&fwdr_t::schedule)>(fwdr.get());
+    }
+
+    // Metrics are served by TCP threads
+    std::unique_ptr<utf::endpoints::metrics_server> metrics_srv;
+    if(config.metrics_port != 0)
+    {
+        // Buffer pool and heap counter keep statistics of their own, they're read on every scrape
+        auto& reg = utf::aux::metrics::registry::global();
+        auto& pool_allocs = reg.make_gauge("utf_buffer_pool_system_allocs", "Blocks the buffer pool took from the system allocator");
+        auto& pool_refills = reg.make_gauge("utf_buffer_pool_depot_refills", "Batches of blocks thread caches took from the shared depot");
+        auto& heap_allocs = reg.make_gauge("utf_heap_allocs", "Calls to operator new in the whole process");
+        reg.add_collector(
+            [&pool_allocs, &pool_refills, &heap_allocs]()
+            {
+                auto pool_stats = utf::aux::buffer_pool::stats();
+                pool_allocs.set(pool_stats.system_allocs);
+                pool_refills.set(pool_stats.depot_refills);
+                heap_allocs.set(utf::aux::heap_allocs());
+            }
+        );
+
+
+        try
+        {
+            metrics_srv = std::make_unique<utf::endpoints::metrics_server>(*iocs_tcp.front(), config.metrics_port);
+        }
+        catch(const std::exception& e)
+        {
+            spdlog::error("Metrics won't be served: {0}", e.what());
+        }
     }
 
-    // Stop io_context's and destroy forwarder when a signal is caught
+    // Stop io_context's when a signal is caught, forwarder is destroyed once they return
     destroyer =
     [&]()
     {
         spdlog::info("Finalizing execution");
 
-        ioc_udp.stop();
-        ioc_tcp.stop();
-        fwdr.reset();
+        for(auto& ioc_udp : iocs_udp)
+            ioc_udp->stop();
+        for(auto& ioc_tcp : iocs_tcp)
+            ioc_tcp->stop();
     };
 
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
 
-    // Decide how many threads to use
-    // TODO: Make it configurable
-    auto conc = std::thread::hardware_concurrency();
-    decltype(conc) num_threads = 1;
-    num_threads += conc > 4 ? conc / 4 : 0;
+    // TCP threads share the io_context, or take one each
     boost::thread_group tg;
-    for (decltype(conc) i = 0; i < num_threads; ++i)
-        tg.create_thread(boost::bind(&io_context::run, &ioc_tcp));
-    
-    ioc_udp.run();
+    for(uint32_t i = 0; i < tcp_threads; ++i)
+    {
+        auto& ioc = *iocs_tcp.at(i % iocs_tcp.size());
+        tg.create_thread([&ioc, pl = rt.tcp, i](){place_thread(pl, i, "TCP"); ioc.run();});
+    }
+
+    // Every UDP shard has a thread of its own
+    for(uint32_t i = 1; i < iocs_udp.size(); ++i)
+    {
+        auto& ioc = *iocs_udp.at(i);
+        tg.create_thread([&ioc, pl = rt.udp, i](){place_thread(pl, i, "UDP"); ioc.run();});
+    }
+
+    // The first one runs on this thread, which is placed last, so that no other thread inherits its affinity
+    place_thread(rt.udp, 0, "UDP");
+    iocs_udp.front()->run();
     tg.join_all();
 
+    // Remaining requests are reported while EDR logger is still alive
+    fwdr.reset();
+
+    auto pool_stats = utf::aux::buffer_pool::stats();
+    spdlog::info("Buffer pool: {0} system allocations, {1} depot refills, {2} depot spills",
+        pool_stats.system_allocs, pool_stats.depot_refills, pool_stats.depot_spills
+    );
+    spdlog::info("Heap: {0} allocations", utf::aux::heap_allocs());
+
     spdlog::info("Exiting");
     return 0;
 }
\ No newline at end of file
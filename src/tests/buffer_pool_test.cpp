@@ -0,0 +1,87 @@
+#include "buffer_pool.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using utf::aux::buffer_pool;
+using utf::aux::byte_buffer;
+
+TEST_GROUP(buffer_pool)
+{
+};
+
+TEST(buffer_pool, reuses_freed_blocks_of_the_same_class)
+{
+    void* a = buffer_pool::allocate(100);
+    buffer_pool::deallocate(a, 100);
+
+    // 100 and 128 bytes share a class, the block comes back from the thread cache
+    uint64_t allocs = buffer_pool::stats().system_allocs;
+    void* b = buffer_pool::allocate(128);
+    POINTERS_EQUAL(a, b);
+    UNSIGNED_LONGS_EQUAL(allocs, buffer_pool::stats().system_allocs);
+    buffer_pool::deallocate(b, 128);
+}
+
+TEST(buffer_pool, blocks_are_large_enough)
+{
+    std::vector<std::pair<void*, size_t>> blocks;
+    for(size_t size : {1, 64, 65, 1000, 4096, 65536})
+    {
+        void* p = buffer_pool::allocate(size);
+        std::memset(p, 0xab, size);
+        blocks.emplace_back(p, size);
+    }
+    for(auto [p, size] : blocks)
+        buffer_pool::deallocate(p, size);
+}
+
+TEST(buffer_pool, oversized_blocks_go_to_the_system)
+{
+    auto before = buffer_pool::stats();
+    void* p = buffer_pool::allocate(1 << 20);
+    buffer_pool::deallocate(p, 1 << 20);
+    auto after = buffer_pool::stats();
+
+    UNSIGNED_LONGS_EQUAL(before.system_allocs + 1, after.system_allocs);
+    UNSIGNED_LONGS_EQUAL(before.system_frees + 1, after.system_frees);
+}
+
+TEST(buffer_pool, blocks_freed_on_another_thread_come_back_through_the_depot)
+{
+    constexpr size_t COUNT = 1024;
+    constexpr size_t SIZE = 512;
+
+    // Warm up: the blocks end up in the depot once the other thread spills them
+    std::vector<void*> blocks;
+    for(size_t i = 0; i < COUNT; ++i)
+        blocks.push_back(buffer_pool::allocate(SIZE));
+    std::thread([&blocks](){for(void* p : blocks) buffer_pool::deallocate(p, SIZE);}).join();
+    blocks.clear();
+
+    auto before = buffer_pool::stats();
+    for(size_t i = 0; i < COUNT; ++i)
+        blocks.push_back(buffer_pool::allocate(SIZE));
+    auto after = buffer_pool::stats();
+
+    UNSIGNED_LONGS_EQUAL(before.system_allocs, after.system_allocs);
+    CHECK(after.depot_refills > before.depot_refills);
+
+    for(void* p : blocks)
+        buffer_pool::deallocate(p, SIZE);
+}
+
+TEST(buffer_pool, byte_buffer_uses_the_pool)
+{
+    byte_buffer warm(300, 'x');
+    warm = byte_buffer();
+
+    uint64_t allocs = buffer_pool::stats().system_allocs;
+    byte_buffer buf(300, 'y');
+    UNSIGNED_LONGS_EQUAL(allocs, buffer_pool::stats().system_allocs);
+    BYTES_EQUAL('y', buf.back());
+}
@@ -0,0 +1,124 @@
+#include "frame.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace utf::endpoints;
+
+TEST_GROUP(frame_buffer)
+{
+    struct frame
+    {
+        uint64_t request_id;
+        std::string payload;
+    };
+
+    std::vector<frame> frames;
+
+    static std::string make_frame(uint64_t request_id, const std::string& payload)
+    {
+        std::string res(FRAME_HEADER_SIZE, '\0');
+        write_frame_header(res.data(), frame_header{static_cast<uint32_t>(payload.size()), request_id});
+        return res + payload;
+    }
+
+    // Writes the bytes the way reads would, at most chunk bytes at a time
+    bool feed(frame_buffer& buf, const std::string& bytes, size_t chunk)
+    {
+        size_t pos = 0;
+        while(pos < bytes.size())
+        {
+            auto space = buf.prepare();
+            size_t count = std::min({chunk, bytes.size() - pos, space.size()});
+            std::memcpy(space.data(), bytes.data() + pos, count);
+            buf.commit(count);
+            pos += count;
+
+            bool is_ok = buf.consume(
+                [this](const frame_header& hdr, const char* begin, const char* end)
+                {
+                    frames.push_back(frame{hdr.request_id, std::string(begin, end)});
+                }
+            );
+            if(!is_ok)
+                return false;
+        }
+        return true;
+    }
+};
+
+TEST(frame_buffer, header_round_trips)
+{
+    char raw[FRAME_HEADER_SIZE];
+    write_frame_header(raw, frame_header{1234, 0x0102030405060708});
+    frame_header hdr = read_frame_header(raw);
+    UNSIGNED_LONGS_EQUAL(1234, hdr.payload_size);
+    CHECK(hdr.request_id == 0x0102030405060708);
+}
+
+TEST(frame_buffer, single_read_yields_every_frame)
+{
+    frame_buffer buf;
+    std::string bytes = make_frame(1, "first") + make_frame(2, "") + make_frame(3, "third");
+    CHECK_TRUE(feed(buf, bytes, bytes.size()));
+
+    UNSIGNED_LONGS_EQUAL(3, frames.size());
+    STRCMP_EQUAL("first", frames[0].payload.c_str());
+    CHECK_TRUE(frames[1].payload.empty());
+    UNSIGNED_LONGS_EQUAL(3, frames[2].request_id);
+    UNSIGNED_LONGS_EQUAL(0, buf.size());
+}
+
+TEST(frame_buffer, frames_split_across_reads_are_reassembled)
+{
+    frame_buffer buf;
+    std::string bytes;
+    for(uint64_t id = 0; id < 50; ++id)
+        bytes += make_frame(id, std::string(id * 7, static_cast<char>('a' + id % 26)));
+
+    CHECK_TRUE(feed(buf, bytes, 3));
+    UNSIGNED_LONGS_EQUAL(50, frames.size());
+    for(uint64_t id = 0; id < 50; ++id)
+    {
+        UNSIGNED_LONGS_EQUAL(id, frames[id].request_id);
+        UNSIGNED_LONGS_EQUAL(id * 7, frames[id].payload.size());
+    }
+}
+
+TEST(frame_buffer, grows_for_large_frames)
+{
+    frame_buffer buf(1024);
+    std::string payload(100000, 'z');
+    CHECK_TRUE(feed(buf, make_frame(7, payload), 4096));
+
+    UNSIGNED_LONGS_EQUAL(1, frames.size());
+    CHECK(frames[0].payload == payload);
+    CHECK(buf.capacity() >= FRAME_HEADER_SIZE + payload.size());
+}
+
+TEST(frame_buffer, oversized_frame_is_malformed)
+{
+    frame_buffer buf;
+    std::string bytes(FRAME_HEADER_SIZE, '\0');
+    write_frame_header(bytes.data(), frame_header{MAX_FRAME_PAYLOAD_SIZE + 1, 1});
+    CHECK_FALSE(feed(buf, bytes, bytes.size()));
+}
+
+TEST(frame_buffer, reset_drops_partial_frame)
+{
+    frame_buffer buf;
+    std::string bytes = make_frame(1, "payload");
+    CHECK_TRUE(feed(buf, bytes.substr(0, 5), 5));
+    UNSIGNED_LONGS_EQUAL(5, buf.size());
+
+    buf.reset();
+    UNSIGNED_LONGS_EQUAL(0, buf.size());
+    CHECK_TRUE(feed(buf, make_frame(2, "next"), 64));
+    UNSIGNED_LONGS_EQUAL(1, frames.size());
+    UNSIGNED_LONGS_EQUAL(2, frames[0].request_id);
+}
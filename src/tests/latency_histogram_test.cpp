@@ -0,0 +1,73 @@
+#include "latency_histogram.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <cstdint>
+
+using utf::aux::latency_histogram;
+
+TEST_GROUP(latency_histogram)
+{
+};
+
+TEST(latency_histogram, empty_histogram_reports_zero)
+{
+    latency_histogram h;
+    UNSIGNED_LONGS_EQUAL(0, h.count());
+    UNSIGNED_LONGS_EQUAL(0, h.percentile(50));
+}
+
+TEST(latency_histogram, small_values_are_exact)
+{
+    latency_histogram h;
+    for(uint64_t v = 1; v <= 100; ++v)
+        h.record(v);
+
+    UNSIGNED_LONGS_EQUAL(100, h.count());
+    UNSIGNED_LONGS_EQUAL(50, h.percentile(50));
+    UNSIGNED_LONGS_EQUAL(99, h.percentile(99));
+    UNSIGNED_LONGS_EQUAL(100, h.percentile(100));
+    UNSIGNED_LONGS_EQUAL(1, h.percentile(0));
+}
+
+TEST(latency_histogram, large_values_are_within_precision)
+{
+    latency_histogram h;
+    h.record(1000000, 99);
+    h.record(5000000);
+
+    uint64_t p50 = h.percentile(50);
+    CHECK(p50 >= 1000000 && p50 <= 1000000 + 1000000 / 500);
+
+    // The largest bucket is capped by the largest value
+    UNSIGNED_LONGS_EQUAL(5000000, h.percentile(100));
+    UNSIGNED_LONGS_EQUAL(5000000, h.max());
+}
+
+TEST(latency_histogram, buckets_cover_every_value)
+{
+    for(uint64_t v : {uint64_t(0), uint64_t(1023), uint64_t(1024), uint64_t(1025), uint64_t(123456789), uint64_t(1) << 40})
+    {
+        size_t idx = latency_histogram::index(v);
+        CHECK(latency_histogram::highest_in_bucket(idx) >= v);
+        if(idx > 0)
+            CHECK(latency_histogram::highest_in_bucket(idx - 1) < v);
+    }
+}
+
+TEST(latency_histogram, merge_adds_counts)
+{
+    latency_histogram a, b;
+    a.record(10, 3);
+    b.record(20, 1);
+    b.record(2000);
+    a.merge(b);
+
+    UNSIGNED_LONGS_EQUAL(5, a.count());
+    UNSIGNED_LONGS_EQUAL(10, a.percentile(60));
+    UNSIGNED_LONGS_EQUAL(20, a.percentile(80));
+    UNSIGNED_LONGS_EQUAL(2000, a.max());
+
+    a.clear();
+    UNSIGNED_LONGS_EQUAL(0, a.count());
+}
@@ -0,0 +1,109 @@
+#include "mpsc_queue.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using utf::scheduling::mpsc_queue;
+
+TEST_GROUP(mpsc_queue)
+{
+};
+
+TEST(mpsc_queue, capacity_is_rounded_up_to_power_of_two)
+{
+    mpsc_queue<int> q(5);
+    UNSIGNED_LONGS_EQUAL(8, q.capacity());
+}
+
+TEST(mpsc_queue, pops_in_push_order)
+{
+    mpsc_queue<int> q(4);
+    CHECK(q.front() == nullptr);
+
+    for(int i = 0; i < 3; ++i)
+        CHECK_TRUE(q.try_push(i));
+    UNSIGNED_LONGS_EQUAL(3, q.size());
+
+    for(int i = 0; i < 3; ++i)
+    {
+        int* v = q.front();
+        CHECK(v != nullptr);
+        LONGS_EQUAL(i, *v);
+        q.pop();
+    }
+    CHECK(q.front() == nullptr);
+    UNSIGNED_LONGS_EQUAL(0, q.size());
+}
+
+TEST(mpsc_queue, refuses_push_when_full)
+{
+    mpsc_queue<int> q(4);
+    for(int i = 0; i < 4; ++i)
+        CHECK_TRUE(q.try_push(i));
+    CHECK_FALSE(q.try_push(4));
+
+    // A popped cell is free for the next lap
+    q.pop();
+    CHECK_TRUE(q.try_push(4));
+    LONGS_EQUAL(1, *q.front());
+}
+
+TEST(mpsc_queue, destroys_remaining_values)
+{
+    auto value = std::make_shared<int>(1);
+    {
+        mpsc_queue<std::shared_ptr<int>> q(4);
+        q.try_push(value);
+        q.try_push(value);
+        LONGS_EQUAL(3, value.use_count());
+    }
+    LONGS_EQUAL(1, value.use_count());
+}
+
+TEST(mpsc_queue, keeps_order_of_every_producer)
+{
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 100000;
+
+    mpsc_queue<int> q(1024);
+    std::vector<std::thread> producers;
+    for(int p = 0; p < PRODUCERS; ++p)
+    {
+        producers.emplace_back([&q, p]()
+        {
+            for(int i = 0; i < PER_PRODUCER; ++i)
+            {
+                while(!q.try_push(p * PER_PRODUCER + i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<int> next(PRODUCERS, 0);
+    int received = 0;
+    bool is_ordered = true;
+    while(received < PRODUCERS * PER_PRODUCER)
+    {
+        int* v = q.front();
+        if(!v)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        int p = *v / PER_PRODUCER;
+        is_ordered = is_ordered && *v % PER_PRODUCER == next[p];
+        ++next[p];
+        ++received;
+        q.pop();
+    }
+
+    for(auto& t : producers)
+        t.join();
+
+    CHECK_TRUE(is_ordered);
+    CHECK(q.front() == nullptr);
+}
@@ -0,0 +1,73 @@
+#include "slot_table.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <cstdint>
+#include <set>
+
+using utf::aux::slot_table;
+
+TEST_GROUP(slot_table)
+{
+};
+
+TEST(slot_table, finds_inserted_values)
+{
+    slot_table<int> table;
+    uint64_t a = table.insert(10);
+    uint64_t b = table.insert(20);
+    UNSIGNED_LONGS_EQUAL(2, table.size());
+
+    CHECK(a != b);
+    LONGS_EQUAL(10, *table.find(a));
+    LONGS_EQUAL(20, *table.find(b));
+}
+
+TEST(slot_table, erased_keys_are_stale)
+{
+    slot_table<int> table;
+    uint64_t key = table.insert(10);
+
+    CHECK_TRUE(table.erase(key));
+    CHECK(table.find(key) == nullptr);
+    CHECK_FALSE(table.erase(key));
+    UNSIGNED_LONGS_EQUAL(0, table.size());
+}
+
+TEST(slot_table, reused_slot_does_not_match_old_key)
+{
+    slot_table<int> table;
+    uint64_t old_key = table.insert(10);
+    table.erase(old_key);
+
+    // Same slot, next generation
+    uint64_t new_key = table.insert(20);
+    UNSIGNED_LONGS_EQUAL(static_cast<uint32_t>(old_key), static_cast<uint32_t>(new_key));
+    CHECK(table.find(old_key) == nullptr);
+    LONGS_EQUAL(20, *table.find(new_key));
+}
+
+TEST(slot_table, unknown_keys_are_not_found)
+{
+    slot_table<int> table;
+    CHECK(table.find(0) == nullptr);
+    CHECK(table.find(uint64_t(1) << 32 | 5) == nullptr);
+    CHECK_FALSE(table.erase(12345));
+}
+
+TEST(slot_table, for_each_visits_taken_slots_only)
+{
+    slot_table<int> table;
+    uint64_t a = table.insert(1);
+    uint64_t b = table.insert(2);
+    uint64_t c = table.insert(3);
+    table.erase(b);
+
+    std::set<uint64_t> keys;
+    int sum = 0;
+    table.for_each([&keys, &sum](uint64_t key, int value){keys.insert(key); sum += value;});
+
+    UNSIGNED_LONGS_EQUAL(2, keys.size());
+    CHECK_TRUE(keys.count(a) && keys.count(c));
+    LONGS_EQUAL(4, sum);
+}
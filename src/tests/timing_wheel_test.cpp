@@ -0,0 +1,88 @@
+#include "timing_wheel.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using utf::aux::timing_wheel;
+
+TEST_GROUP(timing_wheel)
+{
+    std::vector<std::pair<int, uint64_t>> expired;
+
+    void advance(timing_wheel<int>& wheel, uint64_t tick)
+    {
+        wheel.advance(tick, [this](int key, uint64_t expiry_tick){expired.emplace_back(key, expiry_tick);});
+    }
+};
+
+TEST(timing_wheel, expires_keys_at_their_tick)
+{
+    timing_wheel<int> wheel(8);
+    wheel.add(1, 3);
+    wheel.add(2, 5);
+    UNSIGNED_LONGS_EQUAL(2, wheel.size());
+
+    advance(wheel, 2);
+    CHECK_TRUE(expired.empty());
+
+    advance(wheel, 3);
+    UNSIGNED_LONGS_EQUAL(1, expired.size());
+    LONGS_EQUAL(1, expired[0].first);
+    UNSIGNED_LONGS_EQUAL(3, expired[0].second);
+
+    advance(wheel, 10);
+    UNSIGNED_LONGS_EQUAL(2, expired.size());
+    LONGS_EQUAL(2, expired[1].first);
+    UNSIGNED_LONGS_EQUAL(0, wheel.size());
+    UNSIGNED_LONGS_EQUAL(10, wheel.current_tick());
+}
+
+TEST(timing_wheel, keys_beyond_one_revolution_wait_for_their_lap)
+{
+    timing_wheel<int> wheel(4);
+    wheel.add(1, 6);
+
+    // Slot of tick 6 is visited at tick 2 first
+    advance(wheel, 2);
+    CHECK_TRUE(expired.empty());
+
+    advance(wheel, 6);
+    UNSIGNED_LONGS_EQUAL(1, expired.size());
+}
+
+TEST(timing_wheel, past_ticks_expire_on_next_advance)
+{
+    timing_wheel<int> wheel(4);
+    advance(wheel, 5);
+    wheel.add(1, 2);
+
+    advance(wheel, 6);
+    UNSIGNED_LONGS_EQUAL(1, expired.size());
+    UNSIGNED_LONGS_EQUAL(2, expired[0].second);
+}
+
+TEST(timing_wheel, long_jump_visits_every_slot_once)
+{
+    timing_wheel<int> wheel(4);
+    for(int i = 1; i <= 8; ++i)
+        wheel.add(i, i);
+
+    advance(wheel, 100);
+    UNSIGNED_LONGS_EQUAL(8, expired.size());
+    UNSIGNED_LONGS_EQUAL(0, wheel.size());
+}
+
+TEST(timing_wheel, clear_drops_every_key)
+{
+    timing_wheel<int> wheel(4);
+    wheel.add(1, 1);
+    wheel.add(2, 2);
+    wheel.clear();
+    UNSIGNED_LONGS_EQUAL(0, wheel.size());
+
+    advance(wheel, 10);
+    CHECK_TRUE(expired.empty());
+}
@@ -0,0 +1,60 @@
+#include "wrr_schedule.h"
+
+#include "CppUTest/TestHarness.h"
+
+#include <cstdint>
+#include <vector>
+
+using utf::scheduling::wrr_schedule;
+
+TEST_GROUP(wrr_schedule)
+{
+    std::vector<uint32_t> picks(wrr_schedule& sched, size_t count)
+    {
+        std::vector<uint32_t> res;
+        for(size_t i = 0; i < count; ++i)
+            res.push_back(sched.next());
+        return res;
+    }
+};
+
+TEST(wrr_schedule, follows_smooth_weighted_round_robin)
+{
+    // The sequence nginx produces for weights 5, 1, 1
+    wrr_schedule sched({5, 1, 1});
+    UNSIGNED_LONGS_EQUAL(7, sched.size());
+    CHECK(picks(sched, 7) == std::vector<uint32_t>({0, 0, 1, 0, 2, 0, 0}));
+}
+
+TEST(wrr_schedule, sequence_repeats)
+{
+    wrr_schedule sched({3, 2});
+    auto first = picks(sched, sched.size());
+    auto second = picks(sched, sched.size());
+    CHECK(first == second);
+}
+
+TEST(wrr_schedule, picks_are_proportional_to_weights)
+{
+    wrr_schedule sched({4, 2, 1});
+    std::vector<uint32_t> counts(3, 0);
+    for(uint32_t backend : picks(sched, 7 * 10))
+        ++counts[backend];
+
+    UNSIGNED_LONGS_EQUAL(40, counts[0]);
+    UNSIGNED_LONGS_EQUAL(20, counts[1]);
+    UNSIGNED_LONGS_EQUAL(10, counts[2]);
+}
+
+TEST(wrr_schedule, weights_are_reduced_by_their_gcd)
+{
+    wrr_schedule sched({300, 200});
+    UNSIGNED_LONGS_EQUAL(5, sched.size());
+}
+
+TEST(wrr_schedule, zero_weight_counts_as_one)
+{
+    wrr_schedule sched({0, 1});
+    UNSIGNED_LONGS_EQUAL(2, sched.size());
+    CHECK(picks(sched, 2) == std::vector<uint32_t>({0, 1}));
+}
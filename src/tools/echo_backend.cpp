@@ -0,0 +1,486 @@
+// TCP server speaking the forwarder's wire protocol (see frame.h): every request frame is
+// answered with the same frame, which makes it a backend for benchmarks and tests.
+// Slow, jittery and failing backends are modelled with:
+// - a response latency distribution: fixed, exponential or bimodal;
+// - a share of requests that are never answered;
+// - connections closed after a number of requests, responses that are still delayed
+//   are lost with them.
+// Connections are served by a pool of threads, each connection by one thread at a time.
+// Responses are sent once they're due, not in the order of requests.
+
+#include "frame.h"
+
+#include "spdlog/spdlog.h"
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+using asio::ip::tcp;
+
+enum class latency_kind
+{
+    fixed,
+    exponential,
+    bimodal
+};
+
+// Response latency in microseconds
+class latency_model
+{
+public:
+    // "fixed:<us>", "exp:<mean us>" or "bimodal:<fast us>,<slow us>,<slow share>"
+    static latency_model parse(const std::string& spec)
+    {
+        auto fail = [&spec](){return std::invalid_argument("Bad latency: " + spec);};
+
+        auto colon = spec.find(':');
+        if(colon == std::string::npos)
+            throw fail();
+        std::string kind = spec.substr(0, colon);
+
+        std::vector<double> params;
+        const char* it = spec.data() + colon + 1;
+        const char* end = spec.data() + spec.size();
+        while(it < end)
+        {
+            double value;
+            auto [ptr, ec] = std::from_chars(it, end, value);
+            if(ec != std::errc() || value < 0.0)
+                throw fail();
+            params.push_back(value);
+            it = ptr;
+            if(it != end && *it++ != ',')
+                throw fail();
+        }
+
+        latency_model res;
+        if(kind == "fixed" && params.size() == 1)
+            res.m_kind = latency_kind::fixed;
+        else if(kind == "exp" && params.size() == 1)
+            res.m_kind = latency_kind::exponential;
+        else if(kind == "bimodal" && params.size() == 3 && params[2] <= 1.0)
+            res.m_kind = latency_kind::bimodal;
+        else
+            throw fail();
+
+        res.m_params = params;
+        return res;
+    }
+
+    template<typename RandEngine>
+    uint64_t sample(RandEngine& rand_eng) const
+    {
+        switch(m_kind)
+        {
+        case latency_kind::fixed:
+            return m_params[0];
+        case latency_kind::exponential:
+            if(m_params[0] == 0.0)
+                return 0;
+            return std::exponential_distribution<double>(1.0 / m_params[0])(rand_eng);
+        case latency_kind::bimodal:
+            return std::bernoulli_distribution(m_params[2])(rand_eng) ? m_params[1] : m_params[0];
+        }
+        return 0;
+    }
+
+private:
+    latency_kind m_kind = latency_kind::fixed;
+    std::vector<double> m_params = {0.0};
+};
+
+struct backend_options
+{
+    latency_model latency;
+    double drop_rate;
+    uint64_t disconnect_after;
+    uint64_t seed;
+};
+
+struct backend_stats
+{
+    std::atomic_uint64_t connections = 0;
+    std::atomic_uint64_t requests = 0;
+    std::atomic_uint64_t responses = 0;
+    std::atomic_uint64_t dropped = 0;
+    std::atomic_uint64_t disconnects = 0;
+};
+
+class connection : public std::enable_shared_from_this<connection>
+{
+public:
+    connection(tcp::socket&& sock, const backend_options& opts, backend_stats& stats, uint64_t seed) :
+        m_sock(std::move(sock)), m_timer(m_sock.get_executor()),
+        m_opts(opts), m_stats(stats), m_rand_eng(seed)
+    {}
+
+    void start()
+    {
+        // The peer may be gone already
+        boost::system::error_code ec;
+        m_sock.set_option(tcp::no_delay(true), ec);
+        if(ec)
+        {
+            spdlog::error("Can't set up the connection: {0}", ec.message());
+            close();
+            return;
+        }
+        start_read();
+    }
+
+private:
+    struct delayed_frame
+    {
+        steady_clock::time_point due;
+        std::vector<char> frame;
+
+        bool operator>(const delayed_frame& other) const {return due > other.due;}
+    };
+
+    void start_read()
+    {
+        auto self = shared_from_this();
+        m_sock.async_read_some(m_in.prepare(),
+            [self](const boost::system::error_code& ec, size_t bytes_count)
+            {
+                self->read_token(ec, bytes_count);
+            }
+        );
+    }
+
+    void read_token(const boost::system::error_code& ec, size_t bytes_count)
+    {
+        if(ec)
+        {
+            close();
+            return;
+        }
+
+        m_in.commit(bytes_count);
+        auto now = steady_clock::now();
+        bool is_ok = m_in.consume(
+            [this, now](const endpoints::frame_header& hdr, const char* begin, const char* end)
+            {
+                if(m_is_draining)
+                    return;
+                handle_request(hdr, begin, end, now);
+            }
+        );
+        if(!is_ok)
+        {
+            spdlog::error("Received a malformed frame, closing the connection");
+            close();
+            return;
+        }
+
+        flush();
+
+        // Nothing more is read, the connection is closed once ready responses are written
+        if(m_is_draining)
+        {
+            if(!m_is_writing)
+                close();
+            return;
+        }
+        start_read();
+    }
+
+    void handle_request(const endpoints::frame_header& hdr, const char* begin, const char* end, steady_clock::time_point now)
+    {
+        m_stats.requests.fetch_add(1, std::memory_order_relaxed);
+
+        if(m_opts.drop_rate > 0.0 && std::bernoulli_distribution(m_opts.drop_rate)(m_rand_eng))
+            m_stats.dropped.fetch_add(1, std::memory_order_relaxed);
+        else
+        {
+            uint64_t delay_us = m_opts.latency.sample(m_rand_eng);
+            if(delay_us == 0)
+            {
+                append_frame(m_out, hdr, begin, end);
+                ++m_out_frames;
+            }
+            else
+            {
+                delayed_frame df{now + microseconds(delay_us), {}};
+                append_frame(df.frame, hdr, begin, end);
+                m_delayed.push(std::move(df));
+
+                // Wake up earlier if this one is due before the armed deadline
+                if(m_delayed.top().due == now + microseconds(delay_us))
+                    arm_timer();
+            }
+        }
+
+        if(m_opts.disconnect_after > 0 && ++m_requests >= m_opts.disconnect_after)
+        {
+            m_stats.disconnects.fetch_add(1, std::memory_order_relaxed);
+            m_is_draining = true;
+            m_timer.cancel();
+        }
+    }
+
+    static void append_frame(std::vector<char>& dest, const endpoints::frame_header& hdr, const char* begin, const char* end)
+    {
+        size_t offset = dest.size();
+        dest.resize(offset + endpoints::FRAME_HEADER_SIZE);
+        endpoints::write_frame_header(dest.data() + offset, hdr);
+        dest.insert(dest.end(), begin, end);
+    }
+
+    void arm_timer()
+    {
+        m_timer.expires_at(m_delayed.top().due);
+
+        auto self = shared_from_this();
+        m_timer.async_wait(
+            [self](const boost::system::error_code& ec)
+            {
+                if(ec || self->m_is_draining)
+                    return;
+                self->timer_token();
+            }
+        );
+    }
+
+    void timer_token()
+    {
+        auto now = steady_clock::now();
+        while(!m_delayed.empty() && m_delayed.top().due <= now)
+        {
+            const auto& frame = m_delayed.top().frame;
+            m_out.insert(m_out.end(), frame.begin(), frame.end());
+            ++m_out_frames;
+            m_delayed.pop();
+        }
+
+        flush();
+        if(!m_delayed.empty())
+            arm_timer();
+    }
+
+    // Everything collected since the last write goes out in a single one
+    void flush()
+    {
+        if(m_is_writing || m_out.empty())
+            return;
+
+        m_is_writing = true;
+        std::swap(m_out, m_writing);
+        m_writing_frames = m_out_frames;
+        m_out_frames = 0;
+
+        auto self = shared_from_this();
+        asio::async_write(m_sock, asio::buffer(m_writing),
+            [self](const boost::system::error_code& ec, size_t)
+            {
+                self->write_token(ec);
+            }
+        );
+    }
+
+    void write_token(const boost::system::error_code& ec)
+    {
+        m_is_writing = false;
+        if(ec)
+        {
+            close();
+            return;
+        }
+
+        m_stats.responses.fetch_add(m_writing_frames, std::memory_order_relaxed);
+        m_writing.clear();
+        flush();
+
+        if(m_is_draining && !m_is_writing)
+            close();
+    }
+
+    void close()
+    {
+        if(m_is_closed)
+            return;
+
+        m_is_closed = true;
+        m_is_draining = true;
+        boost::system::error_code ignored;
+        m_timer.cancel();
+        m_sock.shutdown(tcp::socket::shutdown_both, ignored);
+        m_sock.close(ignored);
+    }
+
+    tcp::socket m_sock;
+    asio::steady_timer m_timer;
+
+    const backend_options& m_opts;
+    backend_stats& m_stats;
+    std::mt19937_64 m_rand_eng;
+
+    endpoints::frame_buffer m_in;
+    std::priority_queue<delayed_frame, std::vector<delayed_frame>, std::greater<>> m_delayed;
+
+    // Collected responses and the ones being written
+    std::vector<char> m_out;
+    std::vector<char> m_writing;
+    uint64_t m_out_frames = 0;
+    uint64_t m_writing_frames = 0;
+    bool m_is_writing = false;
+
+    uint64_t m_requests = 0;
+    bool m_is_draining = false;
+    bool m_is_closed = false;
+};
+
+class echo_backend
+{
+public:
+    echo_backend(asio::io_context& ioc, uint16_t port, const backend_options& opts) :
+        m_ioc(ioc), m_acceptor(ioc, tcp::endpoint(tcp::v4(), port)), m_opts(opts)
+    {
+        start_accept();
+    }
+
+    const backend_stats& stats() const {return m_stats;}
+
+private:
+    void start_accept()
+    {
+        // Every connection gets a strand, so its handlers never run concurrently
+        m_acceptor.async_accept(asio::make_strand(m_ioc),
+            [this](const boost::system::error_code& ec, tcp::socket sock)
+            {
+                if(ec)
+                {
+                    if(ec == asio::error::operation_aborted)
+                        return;
+                    spdlog::error("Accept error: {0}", ec.message());
+                }
+                else
+                {
+                    // The peer may have reset the connection already
+                    boost::system::error_code ep_ec;
+                    auto remote = sock.remote_endpoint(ep_ec);
+                    if(ep_ec)
+                    {
+                        spdlog::error("Dropping an accepted connection: {0}", ep_ec.message());
+                    }
+                    else
+                    {
+                        uint64_t conn_id = m_stats.connections.fetch_add(1, std::memory_order_relaxed);
+                        spdlog::info("Accepted connection from {0}:{1}", remote.address().to_string(), remote.port());
+                        std::make_shared<connection>(std::move(sock), m_opts, m_stats, m_opts.seed + conn_id)->start();
+                    }
+                }
+                start_accept();
+            }
+        );
+    }
+
+    asio::io_context& m_ioc;
+    tcp::acceptor m_acceptor;
+    const backend_options& m_opts;
+    backend_stats m_stats;
+};
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("port", po::value<uint16_t>(), "TCP port to listen on")
+        ("threads", po::value<uint32_t>()->default_value(std::max(std::thread::hardware_concurrency(), 1u)), "Number of threads")
+        ("latency", po::value<std::string>()->default_value("fixed:0"),
+            "Response latency, us: fixed:<us>, exp:<mean>, bimodal:<fast>,<slow>,<slow share>")
+        ("drop-rate", po::value<double>()->default_value(0.0), "Share of requests that are never answered")
+        ("disconnect-after", po::value<uint64_t>()->default_value(0), "Close connections after this many requests, 0 never")
+        ("seed", po::value<uint64_t>()->default_value(42), "Random seed, every connection gets the next one");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if(vm.count("help") || !vm.count("port"))
+    {
+        std::cout << "Usage: utf_echo_backend [options] --port <port>\n" << desc;
+        return vm.count("help") ? 0 : -1;
+    }
+
+    backend_options opts;
+    try
+    {
+        opts.latency = latency_model::parse(vm.at("latency").as<std::string>());
+        opts.drop_rate = vm.at("drop-rate").as<double>();
+        if(opts.drop_rate < 0.0 || opts.drop_rate > 1.0)
+            throw std::invalid_argument("Drop rate must be within [0, 1]");
+        opts.disconnect_after = vm.at("disconnect-after").as<uint64_t>();
+        opts.seed = vm.at("seed").as<uint64_t>();
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    asio::io_context ioc;
+    std::unique_ptr<echo_backend> backend;
+    try
+    {
+        backend = std::make_unique<echo_backend>(ioc, vm.at("port").as<uint16_t>(), opts);
+    }
+    catch(const std::exception& e)
+    {
+        spdlog::critical("Can't listen on port {0}: {1}", vm.at("port").as<uint16_t>(), e.what());
+        return -1;
+    }
+
+    asio::signal_set signals(ioc, SIGINT, SIGTERM);
+    signals.async_wait(
+        [&ioc](const boost::system::error_code&, int sig)
+        {
+            spdlog::warn("Received signal {0}", strsignal(sig));
+            ioc.stop();
+        }
+    );
+
+    uint32_t num_threads = std::max(vm.at("threads").as<uint32_t>(), 1u);
+    spdlog::info("Listening on port {0} with {1} threads", vm.at("port").as<uint16_t>(), num_threads);
+
+    std::vector<std::thread> threads;
+    for(uint32_t i = 1; i < num_threads; ++i)
+        threads.emplace_back([&ioc](){ioc.run();});
+    ioc.run();
+    for(auto& t : threads)
+        t.join();
+
+    const auto& st = backend->stats();
+    spdlog::info("{0} connections, {1} requests, {2} responses, {3} dropped, {4} disconnects",
+        st.connections.load(), st.requests.load(), st.responses.load(), st.dropped.load(), st.disconnects.load());
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Reads binary EDR files (see edr_file.h) and prints their records as:
+// - text: the same lines the text EDR log has;
+// - csv: a header, then a row per record, response time is empty for timed out requests;
+// - none: records aren't printed.
+// With --percentiles, response time percentiles of every TCP server are printed afterwards.
+
+#include "edr_file.h"
+#include "latency_histogram.h"
+#include "utf_core.h"
+
+#include <boost/program_options.hpp>
+
+#include <charconv>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace utf;
+
+namespace po = boost::program_options;
+
+// Output is written in blocks of about this size
+static constexpr size_t OUTPUT_BLOCK_SIZE = 1 << 20;
+
+static constexpr double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9};
+
+enum class output_format
+{
+    text,
+    csv,
+    none
+};
+
+struct backend_stats
+{
+    aux::latency_histogram resp_time_us;
+    uint64_t timed_out = 0;
+};
+
+// Appends "<octets>,<port>"
+static char* format_csv_endpoint(char* it, char* end, uint32_t addr, uint16_t port)
+{
+    for(int shift = 24; shift >= 0; shift -= 8)
+    {
+        it = std::to_chars(it, end, (addr >> shift) & 0xff).ptr;
+        *it++ = shift > 0 ? '.' : ',';
+    }
+    return std::to_chars(it, end, port).ptr;
+}
+
+static char* format_csv(const aux::edr_record& rec, char* dest)
+{
+    char* end = dest + aux::MAX_EDR_TEXT_SIZE;
+
+    char* it = std::to_chars(dest, end, rec.arrival_time_ms).ptr;
+    *it++ = ',';
+    it = format_csv_endpoint(it, end, rec.client_addr, rec.client_port);
+    *it++ = ',';
+    it = format_csv_endpoint(it, end, rec.server_addr, rec.server_port);
+    *it++ = ',';
+    if(rec.tcp_resp_dur_us != TIMESTAMP_TIMEOUT)
+        it = std::to_chars(it, end, rec.tcp_resp_dur_us).ptr;
+    *it++ = '\n';
+    return it;
+}
+
+static std::string format_ms(uint64_t us)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%lu.%03lu_ms", us / 1000, us % 1000);
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("format", po::value<std::string>()->default_value("text"), "Output format: text, csv or none")
+        ("percentiles", po::bool_switch(), "Print response time percentiles per TCP server")
+        ("files", po::value<std::vector<std::string>>()->multitoken(), "Binary EDR files, in order");
+
+    po::positional_options_description pos;
+    pos.add("files", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+
+    if(vm.count("help") || !vm.count("files"))
+    {
+        std::cout << "Usage: edr_dump [options] <file>...\n" << desc;
+        return vm.count("help") ? 0 : -1;
+    }
+
+    output_format fmt;
+    const auto& fmt_str = vm.at("format").as<std::string>();
+    if(fmt_str == "text")
+        fmt = output_format::text;
+    else if(fmt_str == "csv")
+        fmt = output_format::csv;
+    else if(fmt_str == "none")
+        fmt = output_format::none;
+    else
+    {
+        std::cerr << "Unknown format " << fmt_str << "\n";
+        return -1;
+    }
+    bool with_percentiles = vm.at("percentiles").as<bool>();
+
+    std::string out;
+    out.reserve(OUTPUT_BLOCK_SIZE + aux::MAX_EDR_TEXT_SIZE);
+    if(fmt == output_format::csv)
+        out += "arrival_time_ms,client_addr,client_port,server_addr,server_port,response_time_us\n";
+
+    // Keyed by server address and port
+    std::map<std::pair<uint32_t, uint16_t>, backend_stats> stats;
+
+    for(const auto& path : vm.at("files").as<std::vector<std::string>>())
+    {
+        try
+        {
+            aux::edr_file_reader reader(path);
+            for(const auto& rec : reader.records())
+            {
+                char line[aux::MAX_EDR_TEXT_SIZE];
+                if(fmt == output_format::text)
+                    out.append(line, aux::format_edr(aux::from_record(rec), line));
+                else if(fmt == output_format::csv)
+                    out.append(line, format_csv(rec, line));
+
+                if(out.size() >= OUTPUT_BLOCK_SIZE)
+                {
+                    std::fwrite(out.data(), 1, out.size(), stdout);
+                    out.clear();
+                }
+
+                if(with_percentiles)
+                {
+                    auto& st = stats[{rec.server_addr, rec.server_port}];
+                    if(rec.tcp_resp_dur_us == TIMESTAMP_TIMEOUT)
+                        ++st.timed_out;
+                    else
+                        st.resp_time_us.record(rec.tcp_resp_dur_us);
+                }
+            }
+        }
+        catch(const std::exception& e)
+        {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            std::fflush(stdout);
+            std::cerr << e.what() << "\n";
+            return -1;
+        }
+    }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+
+    for(const auto& [key, st] : stats)
+    {
+        std::cout << boost::asio::ip::address_v4(key.first) << ":" << key.second << ": " <<
+            st.resp_time_us.count() << " responses, " << st.timed_out << " timed out";
+        if(st.resp_time_us.count() > 0)
+        {
+            for(double pct : PERCENTILES)
+                std::cout << ", p" << pct << " " << format_ms(st.resp_time_us.percentile(pct));
+            std::cout << ", max " << format_ms(st.resp_time_us.max());
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
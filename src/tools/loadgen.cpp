@@ -0,0 +1,576 @@
+// UDP load generator for the forwarder (or any UDP echo service):
+// - open loop: requests are sent at a fixed rate, whether replies come or not;
+// - closed loop: a fixed number of requests is kept in flight, every slot sends its next
+//   request as soon as the previous one is answered or times out.
+// Requests are spread over many sockets, each bound to a source port of its own.
+// Every payload starts with a sequence number, a slot and the time the request was meant
+// to be sent, so replies are matched without lookups and latency includes the time
+// a request waited to be sent when the generator fell behind (no coordinated omission).
+// Results are printed to stdout as a JSON object.
+
+#include "latency_histogram.h"
+
+#include <boost/program_options.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+using namespace utf;
+
+namespace po = boost::program_options;
+
+// [sequence number : 8 bytes][send time, ns : 8 bytes][slot : 4 bytes], host byte order
+static constexpr size_t HEADER_SIZE = 20;
+
+// Forwarder's UDP servers don't read more than that
+static constexpr size_t MAX_PAYLOAD_SIZE = 4096;
+
+// Datagrams read from a socket at once
+static constexpr size_t RECV_BATCH_SIZE = 64;
+
+static constexpr size_t MAX_EPOLL_EVENTS = 64;
+
+// Asked for every socket, the kernel may give less
+static constexpr int SOCKET_BUF_SIZE = 4 << 20;
+
+static constexpr uint64_t NS_PER_MS = 1'000'000;
+static constexpr uint64_t NS_PER_S = 1'000'000'000;
+
+static constexpr std::pair<double, const char*> PERCENTILES[] =
+    {{50.0, "p50"}, {90.0, "p90"}, {99.0, "p99"}, {99.9, "p99_9"}};
+
+enum class load_mode
+{
+    open,
+    closed
+};
+
+// Payload sizes in [min, max], picked with probability proportional to weight
+struct size_range
+{
+    uint32_t min;
+    uint32_t max;
+    double weight;
+};
+
+struct loadgen_options
+{
+    sockaddr_in target;
+    load_mode mode;
+    double rate;
+    uint32_t concurrency;
+    uint32_t sockets;
+    uint64_t duration_ns;
+    uint64_t warmup_ns;
+    uint64_t timeout_ns;
+    std::vector<size_range> sizes;
+    uint64_t seed;
+};
+
+// Parses "<size>[:<weight>]" or "<min>-<max>[:<weight>]" entries separated by commas,
+// sizes are clamped to [HEADER_SIZE, MAX_PAYLOAD_SIZE]
+static std::vector<size_range> parse_sizes(const std::string& spec)
+{
+    auto fail = [&spec](){return std::invalid_argument("Bad payload sizes: " + spec);};
+
+    auto read_uint = [&fail](const char*& it, const char* end)
+    {
+        uint32_t value = 0;
+        auto [ptr, ec] = std::from_chars(it, end, value);
+        if(ec != std::errc() || ptr == it)
+            throw fail();
+        it = ptr;
+        return std::clamp<uint32_t>(value, HEADER_SIZE, MAX_PAYLOAD_SIZE);
+    };
+
+    std::vector<size_range> res;
+    std::istringstream entries(spec);
+    std::string entry;
+    while(std::getline(entries, entry, ','))
+    {
+        const char* it = entry.data();
+        const char* end = it + entry.size();
+
+        size_range range{0, 0, 1.0};
+        range.min = read_uint(it, end);
+        range.max = range.min;
+        if(it != end && *it == '-')
+            range.max = read_uint(++it, end);
+        if(it != end && *it == ':')
+        {
+            try
+            {
+                size_t pos = 0;
+                std::string weight(++it, end);
+                range.weight = std::stod(weight, &pos);
+                it += pos;
+            }
+            catch(const std::exception&)
+            {
+                throw fail();
+            }
+        }
+        if(it != end || range.max < range.min || !(range.weight > 0.0))
+            throw fail();
+
+        res.push_back(range);
+    }
+
+    if(res.empty())
+        throw fail();
+    return res;
+}
+
+class load_generator
+{
+public:
+    explicit load_generator(const loadgen_options& opts) :
+        m_opts(opts),
+        m_rand_eng(opts.seed),
+        m_payload(MAX_PAYLOAD_SIZE),
+        m_recv_bufs(RECV_BATCH_SIZE * MAX_PAYLOAD_SIZE),
+        m_recv_hdrs(RECV_BATCH_SIZE),
+        m_recv_iovs(RECV_BATCH_SIZE)
+    {
+        std::vector<double> weights;
+        for(const auto& range : m_opts.sizes)
+            weights.push_back(range.weight);
+        m_range_distr = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+
+        // Payload after the header is arbitrary, it isn't regenerated per request
+        std::uniform_int_distribution<int> char_distr('a', 'z');
+        for(auto& c : m_payload)
+            c = static_cast<char>(char_distr(m_rand_eng));
+
+        for(size_t i = 0; i < RECV_BATCH_SIZE; ++i)
+        {
+            m_recv_iovs[i].iov_base = m_recv_bufs.data() + i * MAX_PAYLOAD_SIZE;
+            m_recv_iovs[i].iov_len = MAX_PAYLOAD_SIZE;
+        }
+
+        m_epoll = ::epoll_create1(0);
+        if(m_epoll < 0)
+            throw std::runtime_error(std::string("Can't create epoll: ") + std::strerror(errno));
+
+        for(uint32_t i = 0; i < m_opts.sockets; ++i)
+            open_socket(i);
+
+        if(m_opts.mode == load_mode::closed)
+            m_slots.resize(m_opts.concurrency);
+    }
+
+    ~load_generator()
+    {
+        for(int fd : m_socks)
+            ::close(fd);
+        ::close(m_epoll);
+    }
+
+    load_generator(const load_generator&) = delete;
+    load_generator& operator=(const load_generator&) = delete;
+
+    void run()
+    {
+        m_start = steady_clock::now();
+        uint64_t end_ns = m_opts.duration_ns;
+
+        if(m_opts.mode == load_mode::closed)
+        {
+            for(uint32_t slot = 0; slot < m_slots.size(); ++slot)
+                send_request(slot, 0);
+        }
+
+        epoll_event events[MAX_EPOLL_EVENTS];
+        for(;;)
+        {
+            uint64_t now = now_ns();
+            bool is_sending = now < end_ns;
+
+            // Wait for the next send in open loop, or check timeouts every millisecond in closed loop
+            int wait_ms = 1;
+            if(m_opts.mode == load_mode::open)
+            {
+                // Every request due by now is sent, even if it's late
+                while(is_sending && due_ns(m_next_seq) <= now)
+                    send_request(0, due_ns(m_next_seq));
+
+                if(!is_sending && now >= end_ns + m_opts.timeout_ns)
+                    break;
+
+                // Shorter waits than a millisecond can't be asked for, spin then
+                uint64_t next_due = due_ns(m_next_seq);
+                if(is_sending)
+                    wait_ms = static_cast<int>(std::min<uint64_t>((next_due - std::min(next_due, now)) / NS_PER_MS, 1));
+            }
+            else
+            {
+                expire_slots(now, is_sending);
+                if(!is_sending && m_in_flight == 0)
+                    break;
+            }
+
+            int count = ::epoll_wait(m_epoll, events, MAX_EPOLL_EVENTS, wait_ms);
+            if(count < 0 && errno != EINTR)
+                throw std::runtime_error(std::string("Wait failed: ") + std::strerror(errno));
+
+            for(int i = 0; i < count; ++i)
+                receive(events[i].data.u32);
+        }
+    }
+
+    std::string report() const
+    {
+        uint64_t lost = m_sent - std::min(m_sent, m_received);
+        double window_s = static_cast<double>(m_opts.duration_ns - m_opts.warmup_ns) / NS_PER_S;
+
+        std::ostringstream out;
+        out << "{\n";
+        if(m_opts.mode == load_mode::open)
+            out << "  \"mode\": \"open\",\n  \"rate\": " << m_opts.rate << ",\n";
+        else
+            out << "  \"mode\": \"closed\",\n  \"concurrency\": " << m_opts.concurrency << ",\n";
+        out <<
+            "  \"sockets\": " << m_opts.sockets << ",\n" <<
+            "  \"duration_s\": " << static_cast<double>(m_opts.duration_ns) / NS_PER_S << ",\n" <<
+            "  \"warmup_s\": " << static_cast<double>(m_opts.warmup_ns) / NS_PER_S << ",\n" <<
+            "  \"timeout_ms\": " << m_opts.timeout_ns / NS_PER_MS << ",\n" <<
+            "  \"sent\": " << m_sent << ",\n" <<
+            "  \"received\": " << m_received << ",\n" <<
+            "  \"lost\": " << lost << ",\n" <<
+            "  \"late\": " << m_late << ",\n" <<
+            "  \"send_errors\": " << m_send_errors << ",\n" <<
+            "  \"invalid\": " << m_invalid << ",\n" <<
+            "  \"loss_ratio\": " << (m_sent > 0 ? static_cast<double>(lost) / m_sent : 0.0) << ",\n" <<
+            "  \"send_rate\": " << m_sent / window_s << ",\n" <<
+            "  \"throughput\": " << m_received / window_s << ",\n" <<
+            "  \"latency_us\": {\n" <<
+            "    \"min\": " << (m_received > 0 ? m_min_latency_us : 0) << ",\n" <<
+            "    \"mean\": " << (m_received > 0 ? static_cast<double>(m_latency_sum_us) / m_received : 0.0) << ",\n";
+        for(auto [pct, name] : PERCENTILES)
+            out << "    \"" << name << "\": " << m_latency_us.percentile(pct) << ",\n";
+        out <<
+            "    \"max\": " << m_latency_us.max() << "\n" <<
+            "  }\n" <<
+            "}\n";
+        return out.str();
+    }
+
+private:
+    struct slot_state
+    {
+        uint64_t seq = 0;
+        uint64_t send_ns = 0;
+        bool is_in_flight = false;
+    };
+
+    void open_socket(uint32_t idx)
+    {
+        int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if(fd < 0)
+            throw std::runtime_error(std::string("Can't open socket: ") + std::strerror(errno));
+        m_socks.push_back(fd);
+
+        // Best effort, bursts are absorbed by socket buffers
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUF_SIZE, sizeof(SOCKET_BUF_SIZE));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUF_SIZE, sizeof(SOCKET_BUF_SIZE));
+
+        // Connected sockets get an ephemeral port and only hear from the target
+        if(::connect(fd, reinterpret_cast<const sockaddr*>(&m_opts.target), sizeof(m_opts.target)) < 0)
+            throw std::runtime_error(std::string("Can't connect socket: ") + std::strerror(errno));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        if(::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+            throw std::runtime_error(std::string("Can't watch socket: ") + std::strerror(errno));
+    }
+
+    uint64_t now_ns() const
+    {
+        return duration_cast<nanoseconds>(steady_clock::now() - m_start).count();
+    }
+
+    // Time the request with the sequence number is meant to be sent at in open loop
+    uint64_t due_ns(uint64_t seq) const
+    {
+        return static_cast<uint64_t>(static_cast<double>(seq) * NS_PER_S / m_opts.rate);
+    }
+
+    bool is_measured(uint64_t send_ns) const
+    {
+        return send_ns >= m_opts.warmup_ns && send_ns < m_opts.duration_ns;
+    }
+
+    size_t next_size()
+    {
+        const auto& range = m_opts.sizes[m_range_distr(m_rand_eng)];
+        if(range.min == range.max)
+            return range.min;
+        return std::uniform_int_distribution<uint32_t>(range.min, range.max)(m_rand_eng);
+    }
+
+    // Slots are used in closed loop only, sockets are taken in turn in open loop
+    void send_request(uint32_t slot, uint64_t send_ns)
+    {
+        uint64_t seq = m_next_seq++;
+        int fd = m_opts.mode == load_mode::closed ?
+            m_socks[slot % m_socks.size()] :
+            m_socks[seq % m_socks.size()];
+
+        std::memcpy(m_payload.data(), &seq, sizeof(seq));
+        std::memcpy(m_payload.data() + 8, &send_ns, sizeof(send_ns));
+        std::memcpy(m_payload.data() + 16, &slot, sizeof(slot));
+
+        if(m_opts.mode == load_mode::closed)
+        {
+            m_slots[slot] = slot_state{seq, send_ns, true};
+            ++m_in_flight;
+        }
+        else
+            m_is_replied.push_back(false);
+
+        bool measured = is_measured(send_ns);
+        if(measured)
+            ++m_sent;
+
+        // A request that can't be sent is lost like any other
+        if(::send(fd, m_payload.data(), next_size(), 0) < 0 && measured)
+            ++m_send_errors;
+    }
+
+    // Requests out of time are given up on, slots send the next ones if it's not over yet
+    void expire_slots(uint64_t now, bool is_sending)
+    {
+        for(uint32_t slot = 0; slot < m_slots.size(); ++slot)
+        {
+            auto& st = m_slots[slot];
+            if(!st.is_in_flight || now - st.send_ns <= m_opts.timeout_ns)
+                continue;
+
+            st.is_in_flight = false;
+            --m_in_flight;
+            if(is_sending)
+                send_request(slot, now);
+        }
+    }
+
+    void receive(uint32_t sock_idx)
+    {
+        for(;;)
+        {
+            for(size_t i = 0; i < RECV_BATCH_SIZE; ++i)
+            {
+                std::memset(&m_recv_hdrs[i], 0, sizeof(mmsghdr));
+                m_recv_hdrs[i].msg_hdr.msg_iov = &m_recv_iovs[i];
+                m_recv_hdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int count = ::recvmmsg(m_socks[sock_idx], m_recv_hdrs.data(), RECV_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+            if(count <= 0)
+                return;
+
+            uint64_t now = now_ns();
+            for(int i = 0; i < count; ++i)
+                handle_reply(static_cast<const char*>(m_recv_iovs[i].iov_base), m_recv_hdrs[i].msg_len, now);
+
+            if(static_cast<size_t>(count) < RECV_BATCH_SIZE)
+                return;
+        }
+    }
+
+    void handle_reply(const char* data, size_t size, uint64_t now)
+    {
+        if(size < HEADER_SIZE)
+        {
+            ++m_invalid;
+            return;
+        }
+
+        uint64_t seq;
+        uint64_t send_ns;
+        uint32_t slot;
+        std::memcpy(&seq, data, sizeof(seq));
+        std::memcpy(&send_ns, data + 8, sizeof(send_ns));
+        std::memcpy(&slot, data + 16, sizeof(slot));
+
+        if(seq >= m_next_seq || send_ns > now)
+        {
+            ++m_invalid;
+            return;
+        }
+
+        // Replies after a timeout or repeated ones don't count
+        bool is_late = now - send_ns > m_opts.timeout_ns;
+        if(m_opts.mode == load_mode::closed)
+        {
+            if(slot >= m_slots.size())
+            {
+                ++m_invalid;
+                return;
+            }
+
+            auto& st = m_slots[slot];
+            if(!st.is_in_flight || st.seq != seq)
+                is_late = true;
+            else
+            {
+                st.is_in_flight = false;
+                --m_in_flight;
+                if(now < m_opts.duration_ns)
+                    send_request(slot, now);
+            }
+        }
+        else
+        {
+            is_late = is_late || m_is_replied[seq];
+            m_is_replied[seq] = true;
+        }
+
+        if(!is_measured(send_ns))
+            return;
+
+        if(is_late)
+        {
+            ++m_late;
+            return;
+        }
+
+        uint64_t latency_us = (now - send_ns) / 1000;
+        m_latency_us.record(latency_us);
+        m_latency_sum_us += latency_us;
+        m_min_latency_us = std::min(m_min_latency_us, latency_us);
+        ++m_received;
+    }
+
+    loadgen_options m_opts;
+
+    std::mt19937_64 m_rand_eng;
+    std::discrete_distribution<size_t> m_range_distr;
+    std::vector<char> m_payload;
+
+    int m_epoll = -1;
+    std::vector<int> m_socks;
+
+    std::vector<char> m_recv_bufs;
+    std::vector<mmsghdr> m_recv_hdrs;
+    std::vector<iovec> m_recv_iovs;
+
+    steady_clock::time_point m_start;
+    uint64_t m_next_seq = 0;
+
+    // Closed loop: request in flight of every slot
+    std::vector<slot_state> m_slots;
+    uint32_t m_in_flight = 0;
+
+    // Open loop: indexed by sequence number
+    std::vector<bool> m_is_replied;
+
+    // Requests sent within the measured window and what became of them
+    uint64_t m_sent = 0;
+    uint64_t m_received = 0;
+    uint64_t m_late = 0;
+    uint64_t m_send_errors = 0;
+    uint64_t m_invalid = 0;
+
+    aux::latency_histogram m_latency_us;
+    uint64_t m_latency_sum_us = 0;
+    uint64_t m_min_latency_us = UINT64_MAX;
+};
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("host", po::value<std::string>()->default_value("127.0.0.1"), "IPv4 address to send requests to")
+        ("port", po::value<uint16_t>(), "UDP port to send requests to")
+        ("mode", po::value<std::string>()->default_value("open"), "open (fixed rate) or closed (fixed concurrency)")
+        ("rate", po::value<double>()->default_value(10'000), "Requests per second, open loop")
+        ("concurrency", po::value<uint32_t>()->default_value(64), "Requests in flight, closed loop")
+        ("sockets", po::value<uint32_t>()->default_value(64), "Number of source ports")
+        ("duration", po::value<double>()->default_value(10), "Seconds to send requests for")
+        ("warmup", po::value<double>()->default_value(1), "Leading seconds that aren't measured")
+        ("timeout", po::value<uint32_t>()->default_value(1000), "Milliseconds after which a request is lost")
+        ("sizes", po::value<std::string>()->default_value("64"),
+            "Payload sizes: <size>[:<weight>] or <min>-<max>[:<weight>], separated by commas, e.g. 64:0.9,512-1400:0.1")
+        ("seed", po::value<uint64_t>()->default_value(42), "Random seed of payload sizes");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if(vm.count("help") || !vm.count("port"))
+    {
+        std::cout << "Usage: utf_loadgen [options] --port <port>\n" << desc;
+        return vm.count("help") ? 0 : -1;
+    }
+
+    loadgen_options opts{};
+    try
+    {
+        opts.target.sin_family = AF_INET;
+        opts.target.sin_port = htons(vm.at("port").as<uint16_t>());
+        if(::inet_pton(AF_INET, vm.at("host").as<std::string>().c_str(), &opts.target.sin_addr) != 1)
+            throw std::invalid_argument("Bad host " + vm.at("host").as<std::string>());
+
+        const auto& mode_str = vm.at("mode").as<std::string>();
+        if(mode_str == "open")
+            opts.mode = load_mode::open;
+        else if(mode_str == "closed")
+            opts.mode = load_mode::closed;
+        else
+            throw std::invalid_argument("Unknown mode " + mode_str);
+
+        opts.rate = vm.at("rate").as<double>();
+        opts.concurrency = vm.at("concurrency").as<uint32_t>();
+        opts.sockets = vm.at("sockets").as<uint32_t>();
+        double duration = vm.at("duration").as<double>();
+        double warmup = vm.at("warmup").as<double>();
+        if(!(opts.rate > 0.0) || opts.concurrency == 0 || opts.sockets == 0)
+            throw std::invalid_argument("Rate, concurrency and sockets must be positive");
+        if(!(duration > 0.0) || warmup < 0.0 || warmup >= duration)
+            throw std::invalid_argument("Duration must be positive and longer than warmup");
+
+        opts.duration_ns = static_cast<uint64_t>(duration * NS_PER_S);
+        opts.warmup_ns = static_cast<uint64_t>(warmup * NS_PER_S);
+        opts.timeout_ns = vm.at("timeout").as<uint32_t>() * NS_PER_MS;
+        opts.sizes = parse_sizes(vm.at("sizes").as<std::string>());
+        opts.seed = vm.at("seed").as<uint64_t>();
+
+        load_generator gen(opts);
+        gen.run();
+        std::cout << gen.report();
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+    return 0;
+}